@@ -27,20 +27,43 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <cstdint>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <tuple>
+#include <typeinfo>
 
+#include <fstream>
 #include <iostream>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace ctream
 {
 
@@ -56,12 +79,98 @@ struct Optional
 
     Optional() : val{T()}, set{false} {}
     Optional(const T& t) : val{t}, set{true} {}
+    Optional(T&& t) : val{std::move(t)}, set{true} {}
     operator bool() const { return set; }
     bool operator !() const { return !set; }
     T& value() { return val; }
     const T& value() const { return val; }
 };
 
+// Identity alias used to exclude a function parameter from template argument
+// deduction (so that lambdas can be passed where std::function is expected)
+template<typename T>
+struct NonDeduced
+{
+    using type = T;
+};
+
+// Compile-time sequence of indices (std::index_sequence is C++14)
+template<size_t... I>
+struct IndexSequence
+{
+};
+
+template<size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...>
+{
+};
+
+template<size_t... I>
+struct MakeIndexSequence<0, I...>
+{
+    using type = IndexSequence<I...>;
+};
+
+/// NUMA node of the current thread (-1 if it is not a NUMA-aware worker)
+inline int& numaNodeOfThread()
+{
+    static thread_local int node = -1;
+    return node;
+}
+
+/// Hint the processor to load the cache line of an address (which may be
+/// invalid)
+inline void prefetchCacheLine(const void* address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void) address;
+#endif
+}
+
+/// Index, among the accumulators of a collect, of the accumulator that
+/// collectors supply in the current thread (its chunk, block or thread), so
+/// that accumulators can depend on it (e.g. the random sequences of samples)
+/// rather than on the order in which they are supplied
+inline std::uint64_t& supplyIndex()
+{
+    static thread_local std::uint64_t index = 0;
+    return index;
+}
+
+/// Pseudo-random generator whose sequences only depend on the seed (on all
+/// platforms), for reproducible sampling
+class Random
+{
+public:
+    explicit Random(std::uint64_t seed, std::uint64_t stream = 0)
+            : m_engine{seed ^ (0x9E3779B97F4A7C15ull * (stream + 1))}
+    {
+    }
+
+    /// Uniform value in [0, 1)
+    double uniform()
+    {
+        return double(m_engine() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /// Number of failed trials before the first success, for trials that
+    /// succeed with probability p
+    std::uint64_t geometric(double p)
+    {
+        if (p >= 1)
+            return 0;
+        if (p <= 0)
+            return UINT64_MAX;
+        const double skip = std::floor(std::log(1 - uniform()) / std::log1p(-p));
+        return skip < 1.8e19 ? std::uint64_t(skip) : UINT64_MAX;
+    }
+
+private:
+    std::mt19937_64 m_engine;
+};
+
 template<typename>
 class Ctream;
 
@@ -80,8 +189,247 @@ constexpr double THREADS_PER_CORE = 2;
 #endif
 constexpr size_t PAGE_SIZE = CTREAM_PAGE_SIZE;
 
+#ifndef CTREAM_CACHE_LINE_SIZE
+#define CTREAM_CACHE_LINE_SIZE 64
+#endif
+constexpr size_t CACHE_LINE_SIZE = CTREAM_CACHE_LINE_SIZE;
+
+#ifndef CTREAM_CANCELLATION_CHECK_INTERVAL
+#define CTREAM_CANCELLATION_CHECK_INTERVAL 1024
+#endif
+constexpr size_t CANCELLATION_CHECK_INTERVAL = CTREAM_CANCELLATION_CHECK_INTERVAL;
+
+#ifndef CTREAM_DETERMINISTIC_BLOCK_SIZE
+#define CTREAM_DETERMINISTIC_BLOCK_SIZE 4096
+#endif
+constexpr size_t DETERMINISTIC_BLOCK_SIZE = CTREAM_DETERMINISTIC_BLOCK_SIZE;
+
+#ifndef CTREAM_ORDERED_BLOCK_SIZE
+#define CTREAM_ORDERED_BLOCK_SIZE 4096
+#endif
+constexpr size_t ORDERED_BLOCK_SIZE = CTREAM_ORDERED_BLOCK_SIZE;
+
+// Default prefetch distance of the sources that reach their elements through
+// pointers (lists)
+#ifndef CTREAM_INDIRECT_PREFETCH_DISTANCE
+#define CTREAM_INDIRECT_PREFETCH_DISTANCE 32
+#endif
+constexpr size_t INDIRECT_PREFETCH_DISTANCE = CTREAM_INDIRECT_PREFETCH_DISTANCE;
+
+// Number of nested collects (collects run by pipeline steps) that have their
+// own scratch slots: the elements of deeper collects are stored in arenas
+#ifndef CTREAM_SCRATCH_SLOT_DEPTHS
+#define CTREAM_SCRATCH_SLOT_DEPTHS 4
+#endif
+constexpr size_t SCRATCH_SLOT_DEPTHS = CTREAM_SCRATCH_SLOT_DEPTHS;
+
 } // namespace fine_tuning
 
+/// Temporary binary file of spilled elements, deleted when it is destroyed
+class SpillFile
+{
+public:
+    /// Create the file in a directory (the system's temporary directory if
+    /// it is empty)
+    explicit SpillFile(const std::string& directory)
+    {
+        if (directory.empty())
+        {
+            m_file = std::tmpfile();
+        }
+        else
+        {
+            static const std::uint64_t process = std::random_device{}();
+            static std::atomic<std::uint64_t> counter{0};
+            m_path = directory + "/ctream-spill-" + std::to_string(process)
+                    + "-" + std::to_string(counter++);
+            m_file = std::fopen(m_path.c_str(), "w+b");
+        }
+        if (!m_file)
+        {
+            throw std::runtime_error("Cannot create a spill file in "
+                    + (directory.empty() ? std::string("the temporary directory")
+                                         : directory));
+        }
+    }
+    ~SpillFile()
+    {
+        std::fclose(m_file);
+        if (!m_path.empty())
+            std::remove(m_path.c_str());
+    }
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    /// Write bytes at an offset
+    void write(size_t offset, const void* data, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        if (bytes && (!seek(offset) || std::fwrite(data, 1, bytes, m_file) != bytes))
+            throw std::runtime_error("Cannot write a spill file");
+    }
+
+    /// Read bytes at an offset
+    void read(size_t offset, void* data, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        if (bytes && (!seek(offset) || std::fread(data, 1, bytes, m_file) != bytes))
+            throw std::runtime_error("Cannot read a spill file");
+    }
+
+private:
+    std::FILE* m_file{nullptr};
+    std::string m_path{};
+    std::mutex m_mutex{};
+
+    /// Move to an offset, with 64-bit offsets where long has 32 bits
+    bool seek(size_t offset)
+    {
+#if defined(_WIN32)
+        using Offset = __int64;
+#elif defined(__unix__) || defined(__APPLE__)
+        using Offset = off_t;
+#else
+        using Offset = long;
+#endif
+        if (std::uint64_t(offset) > std::uint64_t(std::numeric_limits<Offset>::max()))
+            throw std::overflow_error("Spill file offset too large for this platform");
+#if defined(_WIN32)
+        return _fseeki64(m_file, Offset(offset), SEEK_SET) == 0;
+#elif defined(__unix__) || defined(__APPLE__)
+        return fseeko(m_file, Offset(offset), SEEK_SET) == 0;
+#else
+        return std::fseek(m_file, Offset(offset), SEEK_SET) == 0;
+#endif
+    }
+};
+
+/// Elements written contiguously in a spill file
+struct SpillRun
+{
+    std::shared_ptr<SpillFile> file;
+    /// Offset of the first element, in bytes
+    size_t offset;
+    /// Number of elements
+    size_t count;
+};
+
+/// Sequential reader of a spilled run, by blocks of about a page
+template<typename T>
+class SpillRunReader
+{
+public:
+    explicit SpillRunReader(const SpillRun& run)
+            : m_run{run}
+            , m_block(std::max(fine_tuning::PAGE_SIZE / sizeof(T), size_t(1)))
+    {
+        load();
+    }
+    bool done() const { return m_cursor == m_loaded; }
+    const T& current() const { return m_block[m_cursor]; }
+    void next()
+    {
+        if (++m_cursor == m_loaded && m_read < m_run.count)
+            load();
+    }
+
+private:
+    SpillRun m_run;
+    std::vector<T> m_block;
+    /// Elements of the run read so far
+    size_t m_read{0};
+    /// Elements in the block
+    size_t m_loaded{0};
+    /// Position of the current element in the block
+    size_t m_cursor{0};
+
+    void load()
+    {
+        m_loaded = std::min(m_block.size(), m_run.count - m_read);
+        m_run.file->read(m_run.offset + m_read * sizeof(T), m_block.data(),
+                         m_loaded * sizeof(T));
+        m_read += m_loaded;
+        m_cursor = 0;
+    }
+};
+
+/// Memory budget shared by the accumulators of a collect, in bytes of
+/// buffered elements
+class SpillBudget
+{
+public:
+    explicit SpillBudget(size_t limit) : m_limit{limit} {}
+
+    /// Charge bytes, and return whether the budget is exceeded
+    bool charge(size_t bytes) { return m_used.fetch_add(bytes) + bytes > m_limit; }
+    void release(size_t bytes) { m_used -= bytes; }
+    size_t limit() const { return m_limit; }
+
+    /// Number of elements that accumulators charge at once: few enough for
+    /// the budget to be checked often, enough for the atomic to be cheap
+    size_t chargeSize(size_t elementSize) const
+    {
+        const size_t bytes = std::min(m_limit / 8, fine_tuning::PAGE_SIZE);
+        return std::max(bytes / elementSize, size_t(1));
+    }
+
+private:
+    size_t m_limit;
+    std::atomic<size_t> m_used{0};
+};
+
+/// Bytes charged to a spill budget by an accumulator, released when it is
+/// destroyed
+class SpillCharge
+{
+public:
+    SpillCharge() = default;
+    explicit SpillCharge(const std::shared_ptr<SpillBudget>& budget)
+            : m_budget{budget}
+    {
+    }
+    SpillCharge(SpillCharge&& other) noexcept
+            : m_budget{std::move(other.m_budget)}
+            , m_bytes{other.m_bytes}
+    {
+        other.m_bytes = 0;
+    }
+    SpillCharge& operator=(SpillCharge&& other) noexcept
+    {
+        release();
+        m_budget = std::move(other.m_budget);
+        m_bytes = other.m_bytes;
+        other.m_bytes = 0;
+        return *this;
+    }
+    ~SpillCharge() { release(); }
+
+    /// Charge bytes, and return whether the budget is exceeded
+    bool add(size_t bytes)
+    {
+        m_bytes += bytes;
+        return m_budget->charge(bytes);
+    }
+
+    /// Take over the bytes charged by another accumulator of the same budget
+    void absorb(SpillCharge& other)
+    {
+        m_bytes += other.m_bytes;
+        other.m_bytes = 0;
+    }
+
+    void release()
+    {
+        if (m_budget && m_bytes)
+            m_budget->release(m_bytes);
+        m_bytes = 0;
+    }
+
+private:
+    std::shared_ptr<SpillBudget> m_budget{};
+    size_t m_bytes{0};
+};
+
 } // namespace internal
 
 namespace collectors {
@@ -140,6 +488,22 @@ public:
      */
     virtual void accumulate(AccumulatorType& a, const InputType& b) const = 0;
 
+    /**
+     * @brief Feed an element that is not used anymore to an accumulator
+     * 
+     * @details
+     * Called instead of the const reference overload when the element can be
+     * moved from (e.g. it was created by a map, or the stream owns its
+     * source). By default, calls the const reference overload.
+     * 
+     * @param a Accumulator that will receive the element
+     * @param b Element that will be fed the accumulator
+     */
+    virtual void accumulate(AccumulatorType& a, InputType&& b) const
+    {
+        accumulate(a, static_cast<const InputType&>(b));
+    }
+
     /**
      * @brief Feed all the content of an accumulator to another.
      * 
@@ -176,6 +540,118 @@ public:
     T finish(T& a) const override { return a; }
 };
 
+/**
+ * @brief Accumulator of the AccurateSum collector
+ * 
+ */
+template<typename T>
+struct CompensatedSum
+{
+    static constexpr size_t LANES = 8;
+    static constexpr size_t BATCH_SIZE = 4 * LANES;
+
+    /// Sums of interleaved subsequences of the elements
+    std::array<T, LANES> sums;
+    /// Rounding errors of the sums
+    std::array<T, LANES> compensations;
+    /// Elements that were not added to the sums yet
+    std::array<T, BATCH_SIZE> pending;
+    size_t nPending;
+};
+
+/**
+ * @brief Get the sum of the floating-point elements of the stream, with
+ * compensated (Neumaier) summation
+ * 
+ * @details
+ * The error of the sum does not grow with the number of elements, unlike
+ * the one of @ref{Sum}. The elements are buffered and added to independent
+ * lanes in batches, by a loop that the compiler can vectorize.
+ * 
+ * The result only depends on the elements given to each accumulator and on
+ * the order of the combines: use it with @ref{Ctream::deterministic} for
+ * results that do not depend on the number of threads. Code using this
+ * collector must not be compiled with -ffast-math (or other flags that let
+ * the compiler reassociate floating-point operations), which would remove
+ * the compensation.
+ */
+template<typename T>
+class AccurateSum : public Collector<T, CompensatedSum<T>, T>
+{
+    static_assert(std::is_floating_point<T>::value,
+                  "AccurateSum is meant for floating-point elements");
+
+public:
+    using Accumulator = CompensatedSum<T>;
+
+    Accumulator supply() const override
+    {
+        Accumulator a;
+        a.sums.fill(0);
+        a.compensations.fill(0);
+        a.nPending = 0;
+        return a;
+    }
+    void accumulate(Accumulator& a, const T& b) const override
+    {
+        a.pending[a.nPending++] = b;
+        if (a.nPending == Accumulator::BATCH_SIZE)
+            flush(a);
+    }
+    void combine(Accumulator& a, Accumulator& b) const override
+    {
+        flush(a);
+        flush(b);
+        for (size_t l = 0; l < Accumulator::LANES; ++l)
+        {
+            add(a.sums[l], a.compensations[l], b.sums[l]);
+            a.compensations[l] += b.compensations[l];
+        }
+    }
+    T finish(Accumulator& a) const override
+    {
+        flush(a);
+        T sum = 0;
+        T compensation = 0;
+        for (size_t l = 0; l < Accumulator::LANES; ++l)
+        {
+            add(sum, compensation, a.sums[l]);
+            compensation += a.compensations[l];
+        }
+        return sum + compensation;
+    }
+
+private:
+    /// Add x to sum, and its rounding error to compensation (Neumaier)
+    static void add(T& sum, T& compensation, T x)
+    {
+        const T t = sum + x;
+        compensation += (std::fabs(sum) >= std::fabs(x)) ? ((sum - t) + x) : ((x - t) + sum);
+        sum = t;
+    }
+
+    /// Add the pending elements to the lanes (element j goes to lane j % LANES)
+    static void flush(Accumulator& a)
+    {
+        constexpr size_t LANES = Accumulator::LANES;
+        const size_t n = a.nPending;
+        size_t j = 0;
+        for (; j + LANES <= n; j += LANES)
+        {
+            for (size_t l = 0; l < LANES; ++l)
+                add(a.sums[l], a.compensations[l], a.pending[j + l]);
+        }
+        for (size_t l = 0; j < n; ++j, ++l)
+            add(a.sums[l], a.compensations[l], a.pending[j]);
+        a.nPending = 0;
+    }
+};
+
+template<typename T>
+constexpr size_t CompensatedSum<T>::LANES;
+template<typename T>
+constexpr size_t CompensatedSum<T>::BATCH_SIZE;
+
 /**
  * @brief Get the product of the elements of the stream
  * 
@@ -214,6 +690,11 @@ public:
         if (!a || m_comp(b, a.value()))
             a = b;
     };
+    void accumulate(internal::Optional<T>& a, T&& b) const override
+    {
+        if (!a || m_comp(b, a.value()))
+            a = std::move(b);
+    };
     void combine(internal::Optional<T>& a, internal::Optional<T>& b) const override
     {
         if (!a || (b && m_comp(b.value(), a.value())))
@@ -254,6 +735,11 @@ public:
         if (!a || m_comp(a.value(), b))
             a = b;
     };
+    void accumulate(internal::Optional<T>& a, T&& b) const override
+    {
+        if (!a || m_comp(a.value(), b))
+            a = std::move(b);
+    };
     void combine(internal::Optional<T>& a, internal::Optional<T>& b) const override
     {
         if (!a || (b && m_comp(a.value(), b.value())))
@@ -312,6 +798,10 @@ public:
     {
         a.emplace_back(b);
     }
+    void accumulate(std::list<T>& a, T&& b) const override
+    {
+        a.emplace_back(std::move(b));
+    }
     void combine(std::list<T>& a, std::list<T>& b) const override
     {
         a.splice(a.end(), std::move(b));
@@ -343,6 +833,10 @@ public:
     {
         a.emplace_back(b);
     }
+    void accumulate(std::vector<T>& a, T&& b) const override
+    {
+        a.emplace_back(std::move(b));
+    }
     void combine(std::vector<T>& a, std::vector<T>& b) const override
     {
         a.insert(a.end(),
@@ -359,589 +853,4616 @@ private:
 };
 
 /**
- * @brief Create a custom Collector by specifying all functions implementations
+ * @brief Call a function on each element of the stream, from the collecting
+ * threads, and get the number of elements
  * 
+ * @details
+ * The function is called concurrently, on the elements in no particular
+ * order: it must be thread-safe.
  */
-template<typename T, typename A, typename R>
-class Custom : public Collector<T, A, R>
+template<typename T>
+class ForEach : public Collector<T, size_t, size_t>
 {
 public:
-    using InputType = T;
-    using AccumulatorType = A;
-    using ReturnType = R;
+    ForEach(const std::function<void(const T&)>& consumer) : m_consumer{consumer} {}
 
-    /**
-     * @brief Construct a Custom Collector (see @ref{Collector} documentation
-     * for more information)
-     * 
-     * @param supplier Supplier function
-     * @param accumulator Accumulator function
-     * @param combiner Combiner function
-     * @param finisher Finisher function
-     */
-    Custom(const std::function<AccumulatorType()>& supplier,
-           const std::function<void(AccumulatorType&, const InputType&)>& accumulator,
-           const std::function<void(AccumulatorType&, const AccumulatorType&)>& combiner,
-           const std::function<ReturnType(const AccumulatorType&)>& finisher)
-            : m_supplier{supplier}
-            , m_accumulator{accumulator}
-            , m_combiner{combiner}
-            , m_finisher{finisher}
+    size_t supply() const override { return 0; }
+    void accumulate(size_t& a, const T& b) const override
     {
+        m_consumer(b);
+        ++a;
     }
-    AccumulatorType supply() const
+    void combine(size_t& a, size_t& b) const override { a += b; }
+    size_t finish(size_t& a) const override { return a; }
+
+private:
+    std::function<void(const T&)> m_consumer;
+};
+
+/**
+ * @brief Accumulator of the Sample collector: the elements with the smallest
+ * random keys among the accumulated elements
+ * 
+ */
+template<typename T>
+struct Reservoir
+{
+    /// Maximum number of kept elements
+    size_t capacity;
+    /// Kept elements and their keys, as a max-heap on the keys
+    std::vector<std::pair<double, T>> heap;
+    /// Generator of the keys
+    internal::Random random;
+    /// Number of elements to skip before the next one that enters the heap
+    std::uint64_t skip;
+};
+
+/**
+ * @brief Get a uniform random sample of k elements of the stream (or all the
+ * elements if there are less than k), in random order
+ * 
+ * @details
+ * Each element gets a uniform random key, and the sample is made of the
+ * elements with the k smallest keys. Once a reservoir is full, the number of
+ * elements that cannot enter it is drawn directly, so that keys are only
+ * generated for the elements that enter it. Reservoirs are merged by keeping
+ * the k smallest keys of both.
+ * 
+ * The accumulator of the i'th chunk (or block, or thread) of a collect uses
+ * the i'th random sequence of the seed, so the sample only depends on the
+ * seed, on the number of threads and on the collect mode (e.g.
+ * @ref{Ctream::deterministic} or @ref{Ctream::numaAware}), however many
+ * times the collector is used.
+ */
+template<typename T>
+class Sample : public Collector<T, Reservoir<T>, std::vector<T>>
+{
+public:
+    Sample(size_t k, std::uint64_t seed) : m_k{k}, m_seed{seed}
     {
-        return m_supplier();
     }
-    void accumulate(AccumulatorType& a, const InputType& b) const
+    Reservoir<T> supply() const override
     {
-        m_accumulator(a, b);
+        Reservoir<T> r{m_k, {}, internal::Random{m_seed, internal::supplyIndex()}, 0};
+        r.heap.reserve(m_k);
+        return r;
     }
-    void combine(AccumulatorType& a, AccumulatorType& b) const
+    void accumulate(Reservoir<T>& a, const T& b) const override
     {
-        m_combiner(a, b);
+        if (enter(a))
+            push(a, a.random.uniform() * threshold(a), b);
     }
-    ReturnType finish(AccumulatorType& a) const
+    void accumulate(Reservoir<T>& a, T&& b) const override
     {
-        return m_finisher(a);
+        if (enter(a))
+            push(a, a.random.uniform() * threshold(a), std::move(b));
+    }
+    void combine(Reservoir<T>& a, Reservoir<T>& b) const override
+    {
+        for (auto& entry : b.heap)
+        {
+            if (entry.first < threshold(a))
+                push(a, entry.first, std::move(entry.second));
+        }
+        b.heap.clear();
+    }
+    std::vector<T> finish(Reservoir<T>& a) const override
+    {
+        std::sort_heap(a.heap.begin(), a.heap.end(), keyLess);
+        std::vector<T> out;
+        out.reserve(a.heap.size());
+        for (auto& entry : a.heap)
+            out.emplace_back(std::move(entry.second));
+        return out;
     }
+
 private:
-    std::function<AccumulatorType()> m_supplier;
-    std::function<void(AccumulatorType&, const InputType&)> m_accumulator;
-    std::function<void(AccumulatorType&, const AccumulatorType&)> m_combiner;
-    std::function<ReturnType(const AccumulatorType&)> m_finisher;
-};
+    size_t m_k;
+    std::uint64_t m_seed;
 
-/** @} */ // end of collectors
+    static bool keyLess(const std::pair<double, T>& a, const std::pair<double, T>& b)
+    {
+        return a.first < b.first;
+    }
 
-} // namespace collectors
+    /// Largest key that can enter the reservoir
+    static double threshold(const Reservoir<T>& a)
+    {
+        return a.heap.size() < a.capacity ? 1.0 : a.heap.front().first;
+    }
 
-namespace internal
-{
+    /// Whether the next element enters the reservoir
+    static bool enter(Reservoir<T>& a)
+    {
+        if (a.skip == 0)
+            return a.capacity > 0;
+        --a.skip;
+        return false;
+    }
 
-template<typename U>
-void voidDeleterUseWithCaution(void* u)
+    /// Add an element whose key is below the threshold
+    template<typename U>
+    static void push(Reservoir<T>& a, double key, U&& value)
+    {
+        if (a.heap.size() == a.capacity)
+        {
+            std::pop_heap(a.heap.begin(), a.heap.end(), keyLess);
+            a.heap.pop_back();
+        }
+        a.heap.emplace_back(key, std::forward<U>(value));
+        std::push_heap(a.heap.begin(), a.heap.end(), keyLess);
+
+        // Keys are uniform, so the next element enters with probability
+        // threshold(a)
+        if (a.heap.size() == a.capacity)
+            a.skip = a.random.geometric(threshold(a));
+    }
+};
+
+/**
+ * @brief Accumulator of the Histogram collector
+ * 
+ */
+struct HistogramBins
 {
-    // Call the destructor but does not de-allocate the memory
-    reinterpret_cast<U*>(u)->~U();
-}
-using VoidDeleterType = void(void*);
+    /// Count of each bin, with a cache line of padding on each side so that
+    /// the bins of different threads never share a cache line. The last
+    /// padding slot before the bins counts the elements below the first bin,
+    /// and the first one after the bins the elements above the last bin.
+    std::vector<size_t> counts;
+    /// Values of uniform histograms that have not been counted yet
+    std::vector<double> pending;
+};
 
+/**
+ * @brief Count the elements of the stream that fall in each bin of a
+ * histogram
+ * 
+ * @details
+ * Bin i contains the elements in [edges[i], edges[i + 1]). Elements outside
+ * of all the bins are not counted. The values of uniform histograms are
+ * buffered so that their bins are computed in batches, by a loop that the
+ * compiler can vectorize.
+ */
 template<typename T>
-class BasicArena
+class Histogram : public Collector<T, HistogramBins, std::vector<size_t>>
 {
 public:
-    BasicArena() noexcept
+    /**
+     * @brief Histogram with arbitrary bins
+     * 
+     * @param edges Edges of the bins, in increasing order
+     */
+    Histogram(const std::vector<T>& edges)
+            : m_edges{edges}
+            , m_nBins{edges.size() < 2 ? 0 : edges.size() - 1}
     {
     }
 
-    ~BasicArena()
+    /**
+     * @brief Histogram with n bins of the same width
+     * 
+     * @param lo Start of the first bin
+     * @param hi End of the last bin
+     * @param n Number of bins
+     * @return Histogram<T> The histogram collector
+     */
+    static Histogram<T> uniform(T lo, T hi, size_t n)
     {
-        // Destroy all the objects
-        std::lock_guard<std::mutex> objLk{m_objectsMx};
-        for (auto& ptr : m_objects)
-            ptr.delFct(ptr.ptr);
+        Histogram<T> histogram{std::vector<T>{}};
+        histogram.m_nBins = n;
+        histogram.m_uniform = true;
+        histogram.m_lo = double(lo);
+        histogram.m_scale = double(n) / (double(hi) - double(lo));
+        return histogram;
+    }
 
-        // Free the memory
-        std::lock_guard<std::mutex> lk{m_pagesListMx};
-        for (auto& page : m_pages)
+    HistogramBins supply() const override
+    {
+        HistogramBins bins;
+        bins.counts.assign(m_nBins + 2 * PADDING, 0);
+        if (m_uniform)
+            bins.pending.reserve(BATCH_SIZE);
+        return bins;
+    }
+    void accumulate(HistogramBins& a, const T& b) const override
+    {
+        if (m_uniform)
         {
-            std::lock_guard<std::mutex> pageLk{page.mx};
-            freePage(page);
+            a.pending.emplace_back(double(b));
+            if (a.pending.size() == BATCH_SIZE)
+                flush(a);
+        }
+        else
+        {
+            const auto pos = std::upper_bound(m_edges.begin(), m_edges.end(), b);
+            ++a.counts[PADDING - 1 + size_t(pos - m_edges.begin())];
         }
     }
-
-    void* allocate(size_t size) noexcept
+    void combine(HistogramBins& a, HistogramBins& b) const override
     {
-        // This is the only way to ensure page is protected exactly the right
-        // amount of time
-        // It cannot interlock because no thread has to wait for
-        // m_pagesListMx to unlock page.mx
-
-        // Access/create a page with enough space 
-        m_pagesListMx.lock();
-        auto& page = firstAvailablePage(size);
-        page.mx.lock();
-        m_pagesListMx.unlock();
+        flush(a);
+        flush(b);
+        for (size_t i = PADDING; i < PADDING + m_nBins; ++i)
+            a.counts[i] += b.counts[i];
+    }
+    std::vector<size_t> finish(HistogramBins& a) const override
+    {
+        flush(a);
+        return std::vector<size_t>(a.counts.begin() + PADDING,
+                                   a.counts.begin() + PADDING + m_nBins);
+    }
 
-        // Allocate on the page
-        void* data = (void*) (size_t(page.data) + page.cursor);
-        page.cursor += size;
-        page.mx.unlock();
+private:
+    static constexpr size_t PADDING =
+            internal::fine_tuning::CACHE_LINE_SIZE / sizeof(size_t);
+    static constexpr size_t BATCH_SIZE = 256;
 
-        return data;
-    }
+    std::vector<T> m_edges;
+    size_t m_nBins;
+    bool m_uniform{false};
+    double m_lo{0};
+    double m_scale{0};
 
-    template<typename U, typename... Args>
-    U* construct(Args&&... args)
+    /// Count the pending values of a uniform histogram
+    void flush(HistogramBins& a) const
     {
-        void* data = allocate(sizeof(U));
-        auto* obj = new (data) U(std::forward<Args>(args)...);
-        
+        const size_t n = a.pending.size();
+        if (n == 0)
+            return;
+
+        // Bin of each value, clamped to the padding slots around the bins
+        // (NaN values go below the first bin)
+        std::array<std::ptrdiff_t, BATCH_SIZE> bins;
+        const double* values = a.pending.data();
+        const double lo = m_lo;
+        const double scale = m_scale;
+        const double last = double(m_nBins);
+        for (size_t j = 0; j < n; ++j)
         {
-            std::lock_guard<std::mutex> lk{m_objectsMx};
-            m_objects.emplace_back();
-            auto& ptr = m_objects.back();
-            ptr.ptr = data;
-            ptr.delFct = voidDeleterUseWithCaution<U>;
+            double bin = (values[j] - lo) * scale;
+            bin = bin >= 0 ? bin : -1;
+            bin = bin < last ? bin : last;
+            bins[j] = std::ptrdiff_t(bin);
         }
 
-        return obj;
+        size_t* counts = a.counts.data() + PADDING;
+        for (size_t j = 0; j < n; ++j)
+            ++counts[bins[j]];
+        a.pending.clear();
     }
+};
 
-private:
-    struct ArenaPtr
+template<typename T>
+constexpr size_t Histogram<T>::PADDING;
+template<typename T>
+constexpr size_t Histogram<T>::BATCH_SIZE;
+
+/**
+ * @brief Count the occurrences of each distinct element of the stream
+ * 
+ */
+template<typename K>
+class CountBy : public Collector<K, std::unordered_map<K, size_t>,
+                                 std::unordered_map<K, size_t>>
+{
+public:
+    std::unordered_map<K, size_t> supply() const override
     {
-        void* ptr{nullptr};
-        VoidDeleterType* delFct{nullptr};
-    };
-    struct Page
+        return std::unordered_map<K, size_t>{};
+    }
+    void accumulate(std::unordered_map<K, size_t>& a, const K& b) const override
     {
-        void* data{nullptr};
-        size_t cursor{0};
-        size_t size{0};
-        std::mutex mx{};
-    };
-
-    std::list<Page> m_pages{};
-    std::mutex m_pagesListMx{};
+        ++a[b];
+    }
+    void accumulate(std::unordered_map<K, size_t>& a, K&& b) const override
+    {
+        ++a[std::move(b)];
+    }
+    void combine(std::unordered_map<K, size_t>& a,
+                 std::unordered_map<K, size_t>& b) const override
+    {
+        // Add the smallest table to the largest one
+        if (a.size() < b.size())
+            a.swap(b);
+        for (auto& entry : b)
+            a[entry.first] += entry.second;
+        b.clear();
+    }
+    std::unordered_map<K, size_t> finish(std::unordered_map<K, size_t>& a) const override
+    {
+        return std::move(a);
+    }
+};
 
-    std::vector<ArenaPtr> m_objects{};
-    std::mutex m_objectsMx{};
+/**
+ * @brief Split the elements of the stream into n shards, by hash
+ * 
+ * @details
+ * Each thread writes into its own buffer for each shard, and the buffers are
+ * concatenated shard by shard, so the elements are moved only once into
+ * their shard.
+ * 
+ * The shards can also be scattered into sinks as the stream is collected
+ * instead of being returned: each sink receives batches of the elements of
+ * its shard (never concurrently), which it can move from. The returned shards
+ * are then empty.
+ */
+template<typename T>
+class PartitionInto : public Collector<T, std::vector<std::vector<T>>,
+                                       std::vector<std::vector<T>>>
+{
+public:
+    using Shards = std::vector<std::vector<T>>;
+    using HashFunction = std::function<size_t(const T&)>;
+    using Sink = std::function<void(std::vector<T>&)>;
 
-    static void initPage(size_t minSize, Page& out) noexcept
+    /**
+     * @brief Collect the shards
+     * 
+     * @param n Number of shards (at least 1)
+     * @param hash Hash function (the shard of an element is its hash modulo n)
+     */
+    PartitionInto(size_t n, const HashFunction& hash = std::hash<T>{})
+            : m_n{std::max(n, size_t(1))}
+            , m_hash{hash}
     {
-        out.size = (minSize > fine_tuning::PAGE_SIZE)
-                ? minSize
-                : fine_tuning::PAGE_SIZE;
-        out.cursor = 0;
-        out.data = malloc(out.size);
     }
 
-    static void freePage(Page& d) noexcept
+    /**
+     * @brief Scatter the shards into sinks
+     * 
+     * @param sinks One sink per shard (at least 1)
+     * @param hash Hash function (the shard of an element is its hash modulo
+     * the number of sinks)
+     * @param batchSize Number of elements of a shard that a thread buffers
+     * before sending them to the sink
+     */
+    PartitionInto(const std::vector<Sink>& sinks,
+                  const HashFunction& hash = std::hash<T>{},
+                  size_t batchSize = 1024)
+            : m_n{std::max(sinks.size(), size_t(1))}
+            , m_hash{hash}
+            , m_sinks{std::make_shared<SinkSet>(sinks)}
+            , m_batchSize{std::max(batchSize, size_t(1))}
     {
-        free(d.data);
     }
 
-    inline static long occupiedSizeOnPage(const Page& p) noexcept
+    Shards supply() const override
     {
-        return long(p.cursor);
+        return Shards(m_n);
     }
-
-    inline static long availableSizeOnPage(const Page& p) noexcept
+    void accumulate(Shards& a, const T& b) const override
     {
-        return long(p.size) - occupiedSizeOnPage(p);
+        std::vector<T>& shard = a[m_hash(b) % m_n];
+        shard.emplace_back(b);
+        if (m_sinks && shard.size() >= m_batchSize)
+            send(a, size_t(&shard - a.data()));
+    }
+    void accumulate(Shards& a, T&& b) const override
+    {
+        std::vector<T>& shard = a[m_hash(b) % m_n];
+        shard.emplace_back(std::move(b));
+        if (m_sinks && shard.size() >= m_batchSize)
+            send(a, size_t(&shard - a.data()));
+    }
+    void combine(Shards& a, Shards& b) const override
+    {
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            if (a[i].empty())
+            {
+                a[i].swap(b[i]);
+                continue;
+            }
+            a[i].insert(a[i].end(),
+                        std::make_move_iterator(b[i].begin()),
+                        std::make_move_iterator(b[i].end()));
+            b[i].clear();
+        }
+    }
+    Shards finish(Shards& a) const override
+    {
+        if (m_sinks)
+        {
+            for (size_t i = 0; i < m_n; ++i)
+                send(a, i);
+        }
+        return std::move(a);
     }
 
-    Page& firstAvailablePage(size_t size) noexcept
+private:
+    /// Sinks, and the mutexes that prevent concurrent calls to each of them
+    struct SinkSet
     {
-        for (auto& p : m_pages)
+        explicit SinkSet(const std::vector<Sink>& s)
+                : sinks{s}, mutexes(s.size())
         {
-            if (availableSizeOnPage(p) > size)
-                return p;
         }
-        m_pages.emplace_back();
-        auto& newPage = m_pages.back();
-        initPage(size, newPage);
-        return newPage;
+        std::vector<Sink> sinks;
+        std::vector<std::mutex> mutexes;
+    };
+
+    size_t m_n;
+    HashFunction m_hash;
+    std::shared_ptr<SinkSet> m_sinks{};
+    size_t m_batchSize{0};
+
+    /// Send the buffered elements of shard i to its sink
+    void send(Shards& a, size_t i) const
+    {
+        if (a[i].empty() || i >= m_sinks->sinks.size())
+            return;
+        {
+            std::lock_guard<std::mutex> lock{m_sinks->mutexes[i]};
+            m_sinks->sinks[i](a[i]);
+        }
+        a[i].clear();
     }
 };
-using Arena = BasicArena<void>;
-
 
 /**
- * @defgroup ctream Ctream API
- * @details
- * This group contains templated class Ctream which is the entrypoint of this
- * library.
- * 
- * Ctream provides a clear syntax and parallelized implementation for inline
- * data manipulation. Ctream objects can be created using diverse STL
- * containers as source, then modified through data mapping extraction and
- * filtering, and then exported using @ref{Collector} objects into usable
- * types.
+ * @brief Accumulator of the ExternalSort collector
  * 
- * @{
  */
+template<typename T>
+struct SpilledRuns
+{
+    /// Elements that were not spilled yet
+    std::vector<T> buffer;
+    /// Number of buffered elements that were not charged to the budget yet
+    size_t uncharged;
+    internal::SpillCharge charge;
+    /// File of the runs spilled by this accumulator, and its size in bytes
+    std::shared_ptr<internal::SpillFile> file;
+    size_t fileSize;
+    /// Sorted runs spilled by this accumulator and the ones combined into it
+    std::vector<internal::SpillRun> runs;
+    /// Sort and write of the last spilled run
+    std::future<void> writing;
+};
 
 /**
- * @brief Pipeline for data manipulation
+ * @brief Elements sorted by the ExternalSort collector, which are partly
+ * stored in sorted runs on disk
  * 
- * @tparam T Type of the streamed elements
  */
 template<typename T>
-class Ctream
+class SortedRuns
 {
 public:
-    using SourceDataRetriever = std::function<void const*(size_t)>;
-    using PipelineStep = std::function<void const*(void const*)>;
+    using Less = std::function<bool(const T&, const T&)>;
 
-    /**
-     * @name Create from STL containers
-     * @{
-     */
+    SortedRuns(const Less& less,
+               std::vector<internal::SpillRun>&& runs,
+               std::vector<T>&& memory)
+            : m_less{less}
+            , m_runs{std::move(runs)}
+            , m_memory{std::move(memory)}
+    {
+    }
 
-    /**
-     * @brief Construct from a vector
-     * 
-     * @param values Vector containing the values to stream
-     */
-    Ctream(const std::vector<T>& values)
-            : m_sourceData{[&values] (size_t i) { return &values.at(i); }}
-            , m_containerSize{values.size()}
+    /// Number of elements
+    size_t size() const
     {
+        size_t n = m_memory.size();
+        for (const auto& run : m_runs)
+            n += run.count;
+        return n;
     }
 
+    /// Number of runs that were spilled to disk
+    size_t spilledRuns() const { return m_runs.size(); }
+
     /**
-     * @brief Construct from a list
+     * @brief Read the elements in order, by merging the runs
      * 
-     * @param values List containing the values to stream
+     * @details
+     * Equal elements are given in the order of their runs (the order of the
+     * elements of the stream is not kept). Only a block of each run is kept in
+     * memory, and the elements can be read several times.
+     * 
+     * @param consumer Function called on each element
      */
-    Ctream(const std::list<T>& values)
-            : m_sourceData{[this] (size_t i) { return m_elementsWithIndex.at(i); }}
-            , m_containerSize{values.size()}
-            , m_elementsWithIndex{ m_arena->construct<std::vector<const T*>>() }
+    void forEach(const std::function<void(const T&)>& consumer) const
     {
-        // List does not provide random access so we have to store it here
-        m_elementsWithIndex->reserve(values.size());
-        for (const auto& v : values)
-            m_elementsWithIndex->emplace_back(&v);
+        std::vector<std::unique_ptr<internal::SpillRunReader<T>>> readers;
+        readers.reserve(m_runs.size());
+        for (const auto& run : m_runs)
+            readers.emplace_back(new internal::SpillRunReader<T>(run));
+        size_t memoryCursor = 0;
+
+        // Elements kept in memory are the last source
+        const size_t memorySource = m_runs.size();
+        auto done = [&] (size_t source)
+        {
+            return source == memorySource ? memoryCursor == m_memory.size()
+                                          : readers[source]->done();
+        };
+        auto value = [&] (size_t source) -> const T&
+        {
+            return source == memorySource ? m_memory[memoryCursor]
+                                           : readers[source]->current();
+        };
+        // Min-heap of the sources on their current values
+        auto after = [&] (size_t a, size_t b)
+        {
+            if (m_less(value(b), value(a)))
+                return true;
+            return !m_less(value(a), value(b)) && a > b;
+        };
+        std::vector<size_t> heap;
+        heap.reserve(m_runs.size() + 1);
+        for (size_t source = 0; source <= memorySource; ++source)
+        {
+            if (!done(source))
+                heap.emplace_back(source);
+        }
+        std::make_heap(heap.begin(), heap.end(), after);
+
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), after);
+            const size_t source = heap.back();
+            consumer(value(source));
+            if (source == memorySource)
+                ++memoryCursor;
+            else
+                readers[source]->next();
+            if (done(source))
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(), heap.end(), after);
+        }
     }
 
+private:
+    Less m_less;
+    std::vector<internal::SpillRun> m_runs;
+    std::vector<T> m_memory;
+};
+
+/**
+ * @brief Sort the elements of the stream, spilling sorted runs to disk when
+ * they exceed a memory budget
+ * 
+ * @details
+ * Each accumulator buffers its elements, and charges them to a memory budget
+ * shared by the accumulators of the collect. When the budget is exceeded, the
+ * accumulator that exceeded it sorts its buffer into a run and writes it to
+ * its temporary file, in the background: it keeps accumulating into a new
+ * buffer meanwhile (and waits for the write before spilling again), so the
+ * buffered elements take up to about twice the budget. The runs are merged
+ * when the result is read.
+ * 
+ * Elements are spilled as raw bytes, so they must be trivially copyable.
+ */
+template<typename T>
+class ExternalSort : public Collector<T, SpilledRuns<T>, SortedRuns<T>>
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ExternalSort requires trivially copyable elements");
+
+public:
+    using Less = typename SortedRuns<T>::Less;
+
     /**
-     * @brief Construct from a C array
+     * @brief Construct an ExternalSort collector
      * 
-     * @param values Array containing the values to stream
-     * @param size Number of elements in the array
+     * @param memoryBudget Memory budget of the buffered elements, in bytes
+     * @param less Comparison function
+     * @param directory Directory of the spill files (the system's temporary
+     * directory if it is empty)
      */
-    Ctream(const T* values, size_t size)
-            : m_sourceData{[values] (size_t i) { return &values[i]; }}
-            , m_containerSize{size}
+    ExternalSort(size_t memoryBudget,
+                 const Less& less = std::less<T>{},
+                 const std::string& directory = "")
+            : m_less{less}
+            , m_directory{directory}
+            , m_budget{std::make_shared<internal::SpillBudget>(memoryBudget)}
+            , m_chargeSize{m_budget->chargeSize(sizeof(T))}
     {
     }
 
-    /** @} */
-
-    // Internal constructor please do not use
-    Ctream(std::shared_ptr<Arena> arena,
-           size_t containerSize,
-           const SourceDataRetriever& sourceData,
-           const std::vector<PipelineStep>& previousPipeline,
-           const PipelineStep& newPipelineStep)
-            : m_arena{arena}
-            , m_sourceData{sourceData}
-            , m_containerSize{containerSize}
-            , m_pipeline{previousPipeline}
+    SpilledRuns<T> supply() const override
+    {
+        return SpilledRuns<T>{{}, 0, internal::SpillCharge{m_budget},
+                              nullptr, 0, {}, {}};
+    }
+    void accumulate(SpilledRuns<T>& a, const T& b) const override
+    {
+        a.buffer.emplace_back(b);
+        if (++a.uncharged == m_chargeSize)
+            charge(a);
+    }
+    void combine(SpilledRuns<T>& a, SpilledRuns<T>& b) const override
+    {
+        if (b.writing.valid())
+            b.writing.get();
+        a.runs.insert(a.runs.end(), b.runs.begin(), b.runs.end());
+        a.buffer.insert(a.buffer.end(), b.buffer.begin(), b.buffer.end());
+        a.uncharged += b.uncharged;
+        a.charge.absorb(b.charge);
+        b.buffer = std::vector<T>{};
+        b.runs.clear();
+    }
+    SortedRuns<T> finish(SpilledRuns<T>& a) const override
+    {
+        if (a.writing.valid())
+            a.writing.get();
+        std::sort(a.buffer.begin(), a.buffer.end(), m_less);
+        return SortedRuns<T>{m_less, std::move(a.runs), std::move(a.buffer)};
+    }
+
+private:
+    Less m_less;
+    std::string m_directory;
+    std::shared_ptr<internal::SpillBudget> m_budget;
+    /// Number of elements charged to the budget at once
+    size_t m_chargeSize;
+
+    void charge(SpilledRuns<T>& a) const
+    {
+        const bool exceeded = a.charge.add(a.uncharged * sizeof(T));
+        a.uncharged = 0;
+        if (exceeded)
+            spill(a);
+    }
+
+    /// Sort and write the buffer in the background
+    void spill(SpilledRuns<T>& a) const
+    {
+        if (a.writing.valid())
+            a.writing.get();
+        if (!a.file)
+            a.file = std::make_shared<internal::SpillFile>(m_directory);
+        const internal::SpillRun run{a.file, a.fileSize, a.buffer.size()};
+        a.fileSize += run.count * sizeof(T);
+        a.runs.emplace_back(run);
+        a.charge.release();
+
+        const Less less = m_less;
+        a.writing = std::async(std::launch::async,
+                               [less, run] (std::vector<T> elements)
+        {
+            std::sort(elements.begin(), elements.end(), less);
+            run.file->write(run.offset, elements.data(), run.count * sizeof(T));
+        }, std::move(a.buffer));
+        a.buffer = std::vector<T>{};
+    }
+};
+
+/**
+ * @brief Accumulator of the ExternalGroupBy collector
+ * 
+ */
+template<typename T>
+struct SpilledPartitions
+{
+    /// Elements of each partition that were not spilled yet
+    std::vector<std::vector<T>> buffers;
+    /// Number of buffered elements that were not charged to the budget yet
+    size_t uncharged;
+    internal::SpillCharge charge;
+    /// File of the runs spilled by this accumulator, and its size in bytes
+    std::shared_ptr<internal::SpillFile> file;
+    size_t fileSize;
+    /// Runs of each partition spilled by this accumulator and the ones
+    /// combined into it
+    std::vector<std::vector<internal::SpillRun>> runs;
+    /// Write of the last spilled buffers
+    std::future<void> writing;
+};
+
+/**
+ * @brief Elements grouped by the ExternalGroupBy collector, which are partly
+ * stored on disk
+ * 
+ */
+template<typename T, typename K>
+class SpilledGroups
+{
+public:
+    using KeyFunction = std::function<K(const T&)>;
+    using Consumer = std::function<void(const K&, std::vector<T>&)>;
+
+    SpilledGroups(const KeyFunction& key,
+                  std::vector<std::vector<internal::SpillRun>>&& runs,
+                  std::vector<std::vector<T>>&& memory)
+            : m_key{key}
+            , m_runs{std::move(runs)}
+            , m_memory{std::move(memory)}
+    {
+    }
+
+    /// Number of elements
+    size_t size() const
+    {
+        size_t n = 0;
+        for (size_t p = 0; p < m_memory.size(); ++p)
+        {
+            n += m_memory[p].size();
+            for (const auto& run : m_runs[p])
+                n += run.count;
+        }
+        return n;
+    }
+
+    /// Number of runs that were spilled to disk
+    size_t spilledRuns() const
+    {
+        size_t n = 0;
+        for (const auto& runs : m_runs)
+            n += runs.size();
+        return n;
+    }
+
+    /**
+     * @brief Read the groups, partition by partition
+     * 
+     * @details
+     * Each partition is loaded in memory and grouped in turn, so only the
+     * groups of one partition are in memory at once. Groups are given in no
+     * particular order, and so are the elements of a group.
+     * 
+     * @param consumer Function called on the key and the elements of each
+     * group (which it can move from)
+     */
+    void forEach(const Consumer& consumer) const
+    {
+        for (size_t p = 0; p < m_memory.size(); ++p)
+        {
+            std::unordered_map<K, std::vector<T>> groups;
+            for (const auto& run : m_runs[p])
+            {
+                for (internal::SpillRunReader<T> reader{run}; !reader.done(); reader.next())
+                    groups[m_key(reader.current())].emplace_back(reader.current());
+            }
+            for (const T& element : m_memory[p])
+                groups[m_key(element)].emplace_back(element);
+            for (auto& group : groups)
+                consumer(group.first, group.second);
+        }
+    }
+
+private:
+    KeyFunction m_key;
+    std::vector<std::vector<internal::SpillRun>> m_runs;
+    std::vector<std::vector<T>> m_memory;
+};
+
+/**
+ * @brief Group the elements of the stream by key, spilling partitions to
+ * disk when they exceed a memory budget
+ * 
+ * @details
+ * Elements are split into partitions by the hash of their key. As for
+ * @ref{ExternalSort}, the buffered elements are charged to a memory budget,
+ * and the accumulator that exceeds it writes the buffers of its partitions
+ * to its temporary file in the background. The groups are then formed one
+ * partition at a time, so a partition (not the whole stream) must fit in
+ * memory: choose the number of partitions accordingly.
+ * 
+ * Elements are spilled as raw bytes, so they must be trivially copyable.
+ */
+template<typename T, typename K>
+class ExternalGroupBy : public Collector<T, SpilledPartitions<T>,
+                                         SpilledGroups<T, K>>
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ExternalGroupBy requires trivially copyable elements");
+
+public:
+    using KeyFunction = typename SpilledGroups<T, K>::KeyFunction;
+
+    /**
+     * @brief Construct an ExternalGroupBy collector
+     * 
+     * @param key Key function
+     * @param nPartitions Number of partitions (at least 1)
+     * @param memoryBudget Memory budget of the buffered elements, in bytes
+     * @param directory Directory of the spill files (the system's temporary
+     * directory if it is empty)
+     */
+    ExternalGroupBy(const KeyFunction& key,
+                    size_t nPartitions,
+                    size_t memoryBudget,
+                    const std::string& directory = "")
+            : m_key{key}
+            , m_n{std::max(nPartitions, size_t(1))}
+            , m_directory{directory}
+            , m_budget{std::make_shared<internal::SpillBudget>(memoryBudget)}
+            , m_chargeSize{m_budget->chargeSize(sizeof(T))}
+    {
+    }
+
+    SpilledPartitions<T> supply() const override
+    {
+        return SpilledPartitions<T>{std::vector<std::vector<T>>(m_n), 0,
+                                    internal::SpillCharge{m_budget}, nullptr, 0,
+                                    std::vector<std::vector<internal::SpillRun>>(m_n),
+                                    {}};
+    }
+    void accumulate(SpilledPartitions<T>& a, const T& b) const override
+    {
+        a.buffers[std::hash<K>{}(m_key(b)) % m_n].emplace_back(b);
+        if (++a.uncharged < m_chargeSize)
+            return;
+        const bool exceeded = a.charge.add(a.uncharged * sizeof(T));
+        a.uncharged = 0;
+        if (exceeded)
+            spill(a);
+    }
+    void combine(SpilledPartitions<T>& a, SpilledPartitions<T>& b) const override
+    {
+        if (b.writing.valid())
+            b.writing.get();
+        for (size_t p = 0; p < m_n; ++p)
+        {
+            a.runs[p].insert(a.runs[p].end(), b.runs[p].begin(), b.runs[p].end());
+            a.buffers[p].insert(a.buffers[p].end(), b.buffers[p].begin(), b.buffers[p].end());
+            b.buffers[p] = std::vector<T>{};
+            b.runs[p].clear();
+        }
+        a.uncharged += b.uncharged;
+        a.charge.absorb(b.charge);
+    }
+    SpilledGroups<T, K> finish(SpilledPartitions<T>& a) const override
+    {
+        if (a.writing.valid())
+            a.writing.get();
+        return SpilledGroups<T, K>{m_key, std::move(a.runs), std::move(a.buffers)};
+    }
+
+private:
+    KeyFunction m_key;
+    size_t m_n;
+    std::string m_directory;
+    std::shared_ptr<internal::SpillBudget> m_budget;
+    /// Number of elements charged to the budget at once
+    size_t m_chargeSize;
+
+    /// Write the buffers of the partitions in the background
+    void spill(SpilledPartitions<T>& a) const
+    {
+        if (a.writing.valid())
+            a.writing.get();
+        if (!a.file)
+            a.file = std::make_shared<internal::SpillFile>(m_directory);
+        std::vector<internal::SpillRun> written;
+        for (size_t p = 0; p < m_n; ++p)
+        {
+            const internal::SpillRun run{a.file, a.fileSize, a.buffers[p].size()};
+            a.fileSize += run.count * sizeof(T);
+            if (run.count)
+                a.runs[p].emplace_back(run);
+            written.emplace_back(run);
+        }
+        a.charge.release();
+
+        a.writing = std::async(std::launch::async,
+                               [written] (std::vector<std::vector<T>> buffers)
+        {
+            for (size_t p = 0; p < buffers.size(); ++p)
+            {
+                written[p].file->write(written[p].offset, buffers[p].data(),
+                                       written[p].count * sizeof(T));
+            }
+        }, std::move(a.buffers));
+        a.buffers = std::vector<std::vector<T>>(m_n);
+    }
+};
+
+/**
+ * @brief Create a custom Collector by specifying all functions implementations
+ * 
+ */
+template<typename T, typename A, typename R>
+class Custom : public Collector<T, A, R>
+{
+public:
+    using InputType = T;
+    using AccumulatorType = A;
+    using ReturnType = R;
+
+    /**
+     * @brief Construct a Custom Collector (see @ref{Collector} documentation
+     * for more information)
+     * 
+     * @param supplier Supplier function
+     * @param accumulator Accumulator function
+     * @param combiner Combiner function
+     * @param finisher Finisher function
+     */
+    Custom(const std::function<AccumulatorType()>& supplier,
+           const std::function<void(AccumulatorType&, const InputType&)>& accumulator,
+           const std::function<void(AccumulatorType&, const AccumulatorType&)>& combiner,
+           const std::function<ReturnType(const AccumulatorType&)>& finisher)
+            : m_supplier{supplier}
+            , m_accumulator{accumulator}
+            , m_combiner{combiner}
+            , m_finisher{finisher}
+    {
+    }
+    AccumulatorType supply() const
+    {
+        return m_supplier();
+    }
+    void accumulate(AccumulatorType& a, const InputType& b) const
+    {
+        m_accumulator(a, b);
+    }
+    void combine(AccumulatorType& a, AccumulatorType& b) const
+    {
+        m_combiner(a, b);
+    }
+    ReturnType finish(AccumulatorType& a) const
+    {
+        return m_finisher(a);
+    }
+private:
+    std::function<AccumulatorType()> m_supplier;
+    std::function<void(AccumulatorType&, const InputType&)> m_accumulator;
+    std::function<void(AccumulatorType&, const AccumulatorType&)> m_combiner;
+    std::function<ReturnType(const AccumulatorType&)> m_finisher;
+};
+
+/** @} */ // end of collectors
+
+} // namespace collectors
+
+namespace profiling
+{
+
+/**
+ * @defgroup profiling Profiling API
+ * @details
+ * When the library is compiled with `CTREAM_ENABLE_PROFILING` defined, every
+ * collect records statistics on its execution and reports them to the
+ * callback set with @ref{setCallback}. Without this definition, the
+ * instrumentation is compiled out and no statistics are recorded.
+ * @{
+ */
+
+/**
+ * @brief Statistics on the execution of a collect
+ * 
+ */
+struct CollectStats
+{
+    using Duration = std::chrono::nanoseconds;
+
+    /// Number of elements in the source container
+    size_t containerSize{0};
+
+    /// Number of threads that processed the elements
+    size_t threads{0};
+
+    /// stageInputs[k] is the number of elements that entered the k'th step
+    /// of the pipeline. The last value is the number of elements that reached
+    /// the collector
+    std::vector<size_t> stageInputs{};
+
+    /// Time spent by each thread processing its chunk of elements
+    std::vector<Duration> threadTimes{};
+
+    /// Total time spent by threads waiting for the slowest thread
+    Duration idleTime{0};
+
+    /// Time spent combining the accumulators of the threads
+    Duration combineTime{0};
+
+    /// Total time of the collect, preparations included
+    Duration totalTime{0};
+
+    /// Number of bytes allocated in the arena during the collect
+    size_t arenaBytes{0};
+
+    /**
+     * @brief Proportion of the elements that went through a step of the
+     * pipeline (1 for steps that do not filter)
+     * 
+     * @param step Index of the step in the pipeline
+     */
+    double selectivity(size_t step) const
+    {
+        if (step + 1 >= stageInputs.size() || stageInputs[step] == 0)
+            return 1;
+        return double(stageInputs[step + 1]) / double(stageInputs[step]);
+    }
+
+    /**
+     * @brief Ratio between the time of the slowest thread and the average
+     * thread time (1 when the work is perfectly balanced)
+     */
+    double imbalance() const
+    {
+        Duration max{0};
+        Duration total{0};
+        for (const auto& time : threadTimes)
+        {
+            max = std::max(max, time);
+            total += time;
+        }
+        if (total.count() == 0)
+            return 1;
+        return double(max.count() * threadTimes.size()) / double(total.count());
+    }
+};
+
+using Callback = std::function<void(const CollectStats&)>;
+
+/// Storage of the callback (internal use)
+inline Callback& callbackStorage(std::mutex*& mx)
+{
+    static std::mutex callbackMx;
+    static Callback cb;
+    mx = &callbackMx;
+    return cb;
+}
+
+/**
+ * @brief Set the function that receives the statistics of every collect
+ * 
+ * @details
+ * The callback is called by the thread that called collect, after the
+ * result is computed. It is never called if `CTREAM_ENABLE_PROFILING` is not
+ * defined.
+ * 
+ * @param cb Callback (or nullptr to stop receiving statistics)
+ */
+inline void setCallback(const Callback& cb)
+{
+    std::mutex* mx;
+    Callback& storage = callbackStorage(mx);
+    std::lock_guard<std::mutex> lk{*mx};
+    storage = cb;
+}
+
+/// Get the function that receives the statistics of every collect
+inline Callback getCallback()
+{
+    std::mutex* mx;
+    const Callback& storage = callbackStorage(mx);
+    std::lock_guard<std::mutex> lk{*mx};
+    return storage;
+}
+
+/** @} */ // end of profiling
+
+} // namespace profiling
+
+namespace numa
+{
+
+/**
+ * @defgroup numa NUMA API
+ * @details
+ * Streams made NUMA-aware with `numaAware()` are collected by threads pinned
+ * to the nodes of a topology. Each node processes the range of the source
+ * that its memory holds (when it can be determined), allocates its arena
+ * pages and accumulators locally, and combines its accumulators before they
+ * are combined across nodes.
+ * @{
+ */
+
+/**
+ * @brief Description of the NUMA nodes of a machine
+ * 
+ */
+struct Topology
+{
+    /// CPUs of each node
+    std::vector<std::vector<int>> nodes{};
+
+    /// Whether the threads are pinned to the CPUs of their node
+    bool pinThreads{true};
+
+    /// Function that returns the node holding the memory at an address (-1
+    /// if unknown). If empty, the source ranges are assigned to the nodes in
+    /// order
+    std::function<int(const void*)> locator{};
+
+    /**
+     * @brief Get the topology of the current machine
+     * 
+     * @details
+     * On Linux, the nodes are read from `/sys/devices/system/node`. Otherwise,
+     * or if they cannot be read, all the CPUs are in a single node.
+     */
+    static Topology detect()
+    {
+        Topology topology;
+#if defined(__linux__)
+        for (int node = 0; ; ++node)
+        {
+            std::ifstream file{"/sys/devices/system/node/node"
+                    + std::to_string(node) + "/cpulist"};
+            if (!file)
+                break;
+            std::string cpuList;
+            std::getline(file, cpuList);
+            topology.nodes.emplace_back(parseCpuList(cpuList));
+        }
+        topology.locator = [] (const void* address)
+        {
+            // get_mempolicy(MPOL_F_NODE | MPOL_F_ADDR) gives the node of the
+            // page containing the address
+            int node = -1;
+            const long MPOL_F_NODE_ADDR = 1 | 2;
+            if (syscall(SYS_get_mempolicy, &node, nullptr, 0,
+                        const_cast<void*>(address), MPOL_F_NODE_ADDR) != 0)
+                return -1;
+            return node;
+        };
+#endif
+        if (topology.nodes.empty())
+        {
+            const int cpus = std::max(1, int(std::thread::hardware_concurrency()));
+            topology.nodes.emplace_back();
+            for (int cpu = 0; cpu < cpus; ++cpu)
+                topology.nodes.back().emplace_back(cpu);
+        }
+        return topology;
+    }
+
+    /**
+     * @brief Get a simulated topology, to test NUMA-aware streams on any
+     * machine (threads are not pinned)
+     * 
+     * @param nNodes Number of nodes
+     * @param cpusPerNode Number of CPUs of each node
+     */
+    static Topology simulated(size_t nNodes, size_t cpusPerNode)
+    {
+        Topology topology;
+        topology.pinThreads = false;
+        for (size_t node = 0; node < nNodes; ++node)
+        {
+            topology.nodes.emplace_back();
+            for (size_t cpu = 0; cpu < cpusPerNode; ++cpu)
+                topology.nodes.back().emplace_back(int(node * cpusPerNode + cpu));
+        }
+        return topology;
+    }
+
+    /// Parse a list of CPUs such as "0-3,8,10-11"
+    static std::vector<int> parseCpuList(const std::string& cpuList)
+    {
+        std::vector<int> cpus;
+        std::stringstream ss{cpuList};
+        std::string range;
+        while (std::getline(ss, range, ','))
+        {
+            if (range.empty())
+                continue;
+            const size_t dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = (dash == std::string::npos)
+                    ? first
+                    : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.emplace_back(cpu);
+        }
+        return cpus;
+    }
+};
+
+/**
+ * @brief Node of the NUMA-aware worker running the calling thread (-1 if the
+ * thread is not a NUMA-aware worker)
+ */
+inline int currentNode()
+{
+    return internal::numaNodeOfThread();
+}
+
+/// Pin the calling thread to a set of CPUs (internal use)
+inline void pinCurrentThread(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+
+    // Pinning is only an optimization: errors are ignored
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) cpus;
+#endif
+}
+
+/** @} */ // end of numa
+
+} // namespace numa
+
+/**
+ * @brief A token that can be used to cancel the collects it is given to
+ * 
+ * @details
+ * Copies of a token share its state: cancelling any copy cancels them all.
+ */
+class CancellationToken
+{
+public:
+    /// Cancel the collects using this token (thread-safe)
+    void cancel()
+    {
+        m_cancelled->store(true, std::memory_order_relaxed);
+    }
+
+    /// Whether the token was cancelled
+    bool cancelled() const
+    {
+        return m_cancelled->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled{
+            std::make_shared<std::atomic<bool>>(false)};
+};
+
+/**
+ * @brief Thrown by a collect that was cancelled, or that reached its deadline,
+ * before all the elements were processed
+ * 
+ */
+class Cancelled : public std::runtime_error
+{
+public:
+    Cancelled() : std::runtime_error{"ctream: collect cancelled"} {}
+};
+
+namespace internal
+{
+
+/// Conditions under which a collect stops before processing all the elements,
+/// checked by the workers between blocks of elements: cancellation, deadline,
+/// or an exception thrown by an element before the block
+class StopCondition
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StopCondition(const CancellationToken* token, Clock::time_point deadline)
+            : m_token{token ? *token : CancellationToken{}}
+            , m_hasToken{token != nullptr}
+            , m_deadline{deadline}
+    {
+    }
+
+    /// Whether the collect must stop before processing the element at the
+    /// given position
+    bool check(size_t position = 0) const
+    {
+        if (position > m_firstFailure.load(std::memory_order_relaxed))
+            return true;
+        if (m_stopped.load(std::memory_order_relaxed))
+            return true;
+        if ((m_hasToken && m_token.cancelled())
+                || (m_deadline != Clock::time_point::max() && Clock::now() >= m_deadline))
+        {
+            m_stopped.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /// Whether a worker stopped before the end of its elements, because of
+    /// a cancellation or a deadline
+    bool stopped() const
+    {
+        return m_stopped.load(std::memory_order_relaxed);
+    }
+
+    /// Record that the element at the given position threw: the elements
+    /// after it do not need to be processed anymore
+    void fail(size_t position) const
+    {
+        size_t first = m_firstFailure.load(std::memory_order_relaxed);
+        while (position < first
+               && !m_firstFailure.compare_exchange_weak(first, position,
+                                                        std::memory_order_relaxed))
+        {
+        }
+    }
+
+private:
+    CancellationToken m_token;
+    bool m_hasToken;
+    Clock::time_point m_deadline;
+    mutable std::atomic<bool> m_stopped{false};
+    mutable std::atomic<size_t> m_firstFailure{SIZE_MAX};
+};
+
+template<typename U>
+void voidDeleterUseWithCaution(void* u)
+{
+    // Call the destructor but does not de-allocate the memory
+    reinterpret_cast<U*>(u)->~U();
+}
+using VoidDeleterType = void(void*);
+
+template<typename T>
+class BasicArena
+{
+public:
+    BasicArena() noexcept
+    {
+    }
+
+    ~BasicArena()
+    {
+        // Destroy all the objects
+        std::lock_guard<std::mutex> objLk{m_objectsMx};
+        for (auto& ptr : m_objects)
+            ptr.delFct(ptr.ptr);
+
+        // Free the memory
+        std::lock_guard<std::mutex> lk{m_pagesListMx};
+        for (auto& page : m_pages)
+        {
+            std::lock_guard<std::mutex> pageLk{page.mx};
+            freePage(page);
+        }
+    }
+
+    /// Destroy all the objects but keep the pages, so that the memory can be
+    /// reused without being allocated again
+    void reset() noexcept
+    {
+        std::lock_guard<std::mutex> objLk{m_objectsMx};
+        for (auto& ptr : m_objects)
+            ptr.delFct(ptr.ptr);
+        m_objects.clear();
+
+        std::lock_guard<std::mutex> lk{m_pagesListMx};
+        for (auto& page : m_pages)
+        {
+            std::lock_guard<std::mutex> pageLk{page.mx};
+            page.cursor = 0;
+        }
+        m_usedBytes = 0;
+    }
+
+    /// Number of bytes allocated since the creation (or the last reset) of
+    /// the arena
+    size_t usedBytes() noexcept
+    {
+        std::lock_guard<std::mutex> lk{m_pagesListMx};
+        return m_usedBytes;
+    }
+
+    void* allocate(size_t size) noexcept
+    {
+        // This is the only way to ensure page is protected exactly the right
+        // amount of time
+        // It cannot interlock because no thread has to wait for
+        // m_pagesListMx to unlock page.mx
+
+        // Access/create a page with enough space 
+        m_pagesListMx.lock();
+        auto& page = firstAvailablePage(size, numaNodeOfThread());
+        page.mx.lock();
+        m_usedBytes += size;
+
+        // Allocate on the page (the cursors are read by firstAvailablePage,
+        // so they are only modified while the list is locked)
+        void* data = (void*) (size_t(page.data) + page.cursor);
+        page.cursor += size;
+        m_pagesListMx.unlock();
+        page.mx.unlock();
+
+        return data;
+    }
+
+    template<typename U, typename... Args>
+    U* construct(Args&&... args)
+    {
+        void* data = allocate(sizeof(U));
+        auto* obj = new (data) U(std::forward<Args>(args)...);
+        
+        {
+            std::lock_guard<std::mutex> lk{m_objectsMx};
+            m_objects.emplace_back();
+            auto& ptr = m_objects.back();
+            ptr.ptr = data;
+            ptr.delFct = voidDeleterUseWithCaution<U>;
+        }
+
+        return obj;
+    }
+
+private:
+    struct ArenaPtr
+    {
+        void* ptr{nullptr};
+        VoidDeleterType* delFct{nullptr};
+    };
+    struct Page
+    {
+        void* data{nullptr};
+        size_t cursor{0};
+        size_t size{0};
+        int node{-1}; // NUMA node of the thread that allocated the page
+        std::mutex mx{};
+    };
+
+    std::list<Page> m_pages{};
+    std::mutex m_pagesListMx{};
+    size_t m_usedBytes{0};
+
+    std::vector<ArenaPtr> m_objects{};
+    std::mutex m_objectsMx{};
+
+    static void initPage(size_t minSize, Page& out) noexcept
+    {
+        out.size = (minSize > fine_tuning::PAGE_SIZE)
+                ? minSize
+                : fine_tuning::PAGE_SIZE;
+        out.cursor = 0;
+        out.data = malloc(out.size);
+    }
+
+    static void freePage(Page& d) noexcept
+    {
+        free(d.data);
+    }
+
+    inline static long occupiedSizeOnPage(const Page& p) noexcept
+    {
+        return long(p.cursor);
+    }
+
+    inline static long availableSizeOnPage(const Page& p) noexcept
+    {
+        return long(p.size) - occupiedSizeOnPage(p);
+    }
+
+    Page& firstAvailablePage(size_t size, int node) noexcept
+    {
+        // Pages are only shared by threads of the same NUMA node, so that the
+        // memory is local to the threads that use it (the thread that
+        // allocates a page is the first to touch it)
+        for (auto& p : m_pages)
+        {
+            if (p.node == node && availableSizeOnPage(p) > size)
+                return p;
+        }
+        m_pages.emplace_back();
+        auto& newPage = m_pages.back();
+        initPage(size, newPage);
+        newPage.node = node;
+        return newPage;
+    }
+};
+using Arena = BasicArena<void>;
+
+/// Whether the elements of type U created by a pipeline step are stored in a
+/// per-thread scratch slot instead of the arena: small trivially copyable
+/// values need neither an allocation nor a destructor, and are used by the
+/// next steps before the next element is computed by the same thread
+template<typename U>
+struct UsesScratch : std::integral_constant<bool,
+        std::is_trivially_copyable<U>::value
+        && sizeof(U) <= fine_tuning::CACHE_LINE_SIZE>
+{
+};
+
+/// Whether C is a collector of elements of type T (false for types that are
+/// not collectors)
+template<typename C, typename T, typename = void>
+struct IsCollectorOf : std::false_type
+{
+};
+
+template<typename C, typename T>
+struct IsCollectorOf<C, T, typename std::enable_if<std::is_base_of<
+        collectors::Collector<T, typename C::AccumulatorType, typename C::ReturnType>,
+        C>::value>::type> : std::true_type
+{
+};
+
+/// Arena of the collect running in the current thread (nullptr if none), where
+/// the elements created by pipeline steps are stored: they are only used until
+/// they are accumulated, so they are freed as soon as the collect ends
+inline Arena*& runArena()
+{
+    static thread_local Arena* arena = nullptr;
+    return arena;
+}
+
+/// Number of collects running in the current thread, nested in each other (a
+/// pipeline step can collect another stream)
+inline size_t& collectDepth()
+{
+    static thread_local size_t depth = 0;
+    return depth;
+}
+
+/// Makes an arena the run arena of the current thread during its lifetime
+class RunArenaScope
+{
+public:
+    explicit RunArenaScope(Arena& arena) : m_previous{runArena()}
+    {
+        runArena() = &arena;
+        ++collectDepth();
+    }
+    ~RunArenaScope()
+    {
+        --collectDepth();
+        runArena() = m_previous;
+    }
+    RunArenaScope(const RunArenaScope&) = delete;
+    RunArenaScope& operator=(const RunArenaScope&) = delete;
+
+private:
+    Arena* m_previous;
+};
+
+/// Run arenas of the collects of a stream and of the streams created from it:
+/// each collect borrows one, which is reset at the end of the collect and kept
+/// for the next one, so that its pages are only allocated once. Concurrent
+/// collects borrow different arenas
+class RunArenas
+{
+public:
+    /// Arena borrowed by a collect during its lifetime
+    class Lease
+    {
+    public:
+        explicit Lease(RunArenas& owner) : m_owner(owner), m_arena{owner.take()}
+        {
+        }
+        ~Lease()
+        {
+            m_owner.give(std::move(m_arena));
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        Arena& arena() const
+        {
+            return *m_arena;
+        }
+
+    private:
+        RunArenas& m_owner;
+        std::unique_ptr<Arena> m_arena;
+    };
+
+private:
+    std::mutex m_mx{};
+    std::vector<std::unique_ptr<Arena>> m_free{};
+
+    std::unique_ptr<Arena> take()
+    {
+        {
+            std::lock_guard<std::mutex> lk{m_mx};
+            if (!m_free.empty())
+            {
+                std::unique_ptr<Arena> arena = std::move(m_free.back());
+                m_free.pop_back();
+                return arena;
+            }
+        }
+        return std::unique_ptr<Arena>{new Arena};
+    }
+
+    void give(std::unique_ptr<Arena> arena) noexcept
+    {
+        // The elements of the collect are not used anymore
+        arena->reset();
+        try
+        {
+            std::lock_guard<std::mutex> lk{m_mx};
+            m_free.emplace_back(std::move(arena));
+        }
+        catch (...)
+        {
+            // The arena is freed instead of being kept
+        }
+    }
+};
+
+/// Create an element in the run arena, or in the arena of the stream outside
+/// of collects
+template<typename U, typename... Args>
+const U* constructElementIn(Arena& arena, std::false_type, Args&&... args)
+{
+    Arena* run = runArena();
+    return (run ? *run : arena).construct<U>(std::forward<Args>(args)...);
+}
+
+/// Per-thread slot for the elements of type U created by pipeline steps, at
+/// the depth of the collect running in the thread so that nested collects do
+/// not overwrite the elements of the outer ones (nullptr if the collects are
+/// nested too deeply)
+template<typename U>
+U* scratchSlot()
+{
+    using Slot = typename std::aligned_storage<sizeof(U), alignof(U)>::type;
+    constexpr size_t DEPTHS = fine_tuning::SCRATCH_SLOT_DEPTHS;
+    static thread_local Slot slots[DEPTHS];
+    const size_t depth = collectDepth();
+    return depth < DEPTHS ? reinterpret_cast<U*>(&slots[depth]) : nullptr;
+}
+
+/// Create an element in the scratch slot of its type (or in the run arena if
+/// there is none)
+template<typename U, typename... Args>
+const U* constructElementIn(Arena& arena, std::true_type, Args&&... args)
+{
+    // The arguments may refer to the slot itself
+    const U value(std::forward<Args>(args)...);
+    U* slot = scratchSlot<U>();
+    if (!slot)
+        return constructElementIn<U>(arena, std::false_type(), value);
+    return new (slot) U(value);
+}
+
+/// Create an element produced by a pipeline step, where it is cheapest
+template<typename U, typename... Args>
+const U* constructElement(Arena& arena, Args&&... args)
+{
+    return constructElementIn<U>(arena, UsesScratch<U>(), std::forward<Args>(args)...);
+}
+
+#ifdef CTREAM_ENABLE_PROFILING
+
+/// Records the statistics of a collect
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Profiler(profiling::CollectStats* stats,
+             size_t containerSize,
+             size_t nThreads,
+             size_t nSteps,
+             Arena& arena,
+             Arena& runArena)
+            : m_stats{stats ? *stats : m_localStats}
+            , m_arena{arena}
+            , m_runArena{runArena}
+            , m_arenaBytesAtStart{arena.usedBytes()}
+            , m_start{Clock::now()}
+            , m_threadStarts(nThreads)
+            , m_previousCounters(nThreads)
+            // Counters are padded so that threads do not share cache lines
+            , m_counters(nThreads, std::vector<size_t>(nSteps + 1 + PADDING))
+    {
+        m_stats = profiling::CollectStats{};
+        m_stats.containerSize = containerSize;
+        m_stats.threads = nThreads;
+        m_stats.stageInputs.assign(nSteps + 1, 0);
+        m_stats.threadTimes.assign(nThreads, profiling::CollectStats::Duration{0});
+    }
+
+    /// Called by thread t before it processes its chunk
+    void startThread(size_t t)
+    {
+        m_previousCounters[t] = currentCounters();
+        currentCounters() = m_counters[t].data();
+        m_threadStarts[t] = Clock::now();
+    }
+
+    /// Called by thread t after it processed its chunk
+    void stopThread(size_t t)
+    {
+        m_stats.threadTimes[t] = std::chrono::duration_cast<
+                profiling::CollectStats::Duration>(Clock::now() - m_threadStarts[t]);
+        currentCounters() = m_previousCounters[t];
+    }
+
+    void startCombine()
+    {
+        m_combineStart = Clock::now();
+    }
+
+    void stopCombine()
+    {
+        m_stats.combineTime = std::chrono::duration_cast<
+                profiling::CollectStats::Duration>(Clock::now() - m_combineStart);
+    }
+
+    /// Complete the statistics and report them to the callback
+    void finish()
+    {
+        m_stats.totalTime = std::chrono::duration_cast<
+                profiling::CollectStats::Duration>(Clock::now() - m_start);
+        m_stats.arenaBytes = m_arena.usedBytes() - m_arenaBytesAtStart
+                + m_runArena.usedBytes();
+
+        for (const auto& counters : m_counters)
+            for (size_t k = 0; k < m_stats.stageInputs.size(); ++k)
+                m_stats.stageInputs[k] += counters[k];
+
+        profiling::CollectStats::Duration max{0};
+        for (const auto& time : m_stats.threadTimes)
+            max = std::max(max, time);
+        for (const auto& time : m_stats.threadTimes)
+            m_stats.idleTime += max - time;
+
+        const auto cb = profiling::getCallback();
+        if (cb)
+            cb(m_stats);
+    }
+
+    /// Stage counters of the collect running in the current thread (nullptr
+    /// if none is being profiled)
+    static size_t*& currentCounters()
+    {
+        static thread_local size_t* counters = nullptr;
+        return counters;
+    }
+
+private:
+    static constexpr size_t PADDING = 64 / sizeof(size_t);
+
+    profiling::CollectStats m_localStats{};
+    profiling::CollectStats& m_stats;
+    Arena& m_arena;
+    Arena& m_runArena;
+    size_t m_arenaBytesAtStart{0};
+    Clock::time_point m_start{};
+    Clock::time_point m_combineStart{};
+    std::vector<Clock::time_point> m_threadStarts{};
+    std::vector<size_t*> m_previousCounters{};
+    std::vector<std::vector<size_t>> m_counters{};
+};
+
+#else
+
+/// Profiling is disabled: everything is compiled out
+class Profiler
+{
+public:
+    Profiler(profiling::CollectStats*, size_t, size_t, size_t, Arena&, Arena&) {}
+    void startThread(size_t) {}
+    void stopThread(size_t) {}
+    void startCombine() {}
+    void stopCombine() {}
+    void finish() {}
+};
+
+#endif
+
+/// Profiles the work of a thread during its lifetime
+class ProfiledThread
+{
+public:
+    ProfiledThread(Profiler& profiler, size_t t) : m_profiler{profiler}, m_t{t}
+    {
+        m_profiler.startThread(t);
+    }
+    ~ProfiledThread()
+    {
+        m_profiler.stopThread(m_t);
+    }
+    ProfiledThread(const ProfiledThread&) = delete;
+    ProfiledThread& operator=(const ProfiledThread&) = delete;
+
+private:
+    Profiler& m_profiler;
+    size_t m_t;
+};
+
+/// Number of hardware threads (queried once: the query reads system files on
+/// some platforms, which costs more than a small collect)
+inline size_t hardwareConcurrency()
+{
+    static const size_t concurrency = std::thread::hardware_concurrency();
+    return concurrency;
+}
+
+/// Number of threads worth using to process a container of the given size
+/// (limited to maxThreads if it is not 0)
+inline size_t threadsFor(size_t containerSize, size_t maxThreads = 0)
+{
+    constexpr size_t MULTITHREAD_MIN_SIZE = fine_tuning::MULTITHREAD_MIN_SIZE;
+    constexpr double THREADS_PER_CORE = fine_tuning::THREADS_PER_CORE;
+
+    size_t nThreads = std::min(
+        1 + containerSize / MULTITHREAD_MIN_SIZE,
+        size_t(THREADS_PER_CORE * hardwareConcurrency()));
+    if (maxThreads)
+        nThreads = std::min(nThreads, maxThreads);
+
+    // hardware_concurrency may be unknown (0)
+    return std::max(nThreads, size_t(1));
+}
+
+/// Supply the accumulator that has the given index among the accumulators of
+/// a collect (see supplyIndex)
+template<typename T, typename A, typename R>
+A supplyAt(const collectors::Collector<T, A, R>& collector, std::uint64_t index)
+{
+    struct Restore
+    {
+        std::uint64_t previous;
+        ~Restore() { supplyIndex() = previous; }
+    } restore{supplyIndex()};
+    supplyIndex() = index;
+    return collector.supply();
+}
+
+/// Threads whose exceptions are rethrown in the thread that joins them
+class WorkerThreads
+{
+public:
+    explicit WorkerThreads(size_t nThreads) : m_errors(nThreads)
+    {
+        m_threads.reserve(nThreads);
+    }
+
+    /// Join the threads if they were not (e.g. a thread could not be created)
+    ~WorkerThreads()
+    {
+        for (auto& thread : m_threads)
+            if (thread.joinable())
+                thread.join();
+    }
+
+    /// Run fn in a new thread, as worker i
+    template<typename F>
+    void spawn(size_t i, const F& fn)
+    {
+        std::exception_ptr& error = m_errors[i];
+        m_threads.emplace_back([fn, &error] ()
+        {
+            try
+            {
+                fn();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        });
+    }
+
+    /// Wait for all the threads, then rethrow the exception of the first
+    /// worker that failed (workers process increasing ranges of elements, so
+    /// this is the exception of the first failing element)
+    void join()
+    {
+        for (auto& thread : m_threads)
+            if (thread.joinable())
+                thread.join();
+        for (const auto& error : m_errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+
+private:
+    std::vector<std::exception_ptr> m_errors;
+    std::vector<std::thread> m_threads{};
+};
+
+/// Split [0, size) into nThreads contiguous ranges and call
+/// fn(threadIndex, first, last) on each of them in a separate thread.
+/// If only one thread is needed, fn is called directly in the current thread.
+/// If calls throw, the exception of the first range is rethrown once all the
+/// calls ended.
+template<typename F>
+void parallelFor(size_t size, size_t nThreads, const F& fn)
+{
+    if (nThreads < 2)
+    {
+        fn(size_t(0), size_t(0), size);
+        return;
+    }
+
+    WorkerThreads threads{nThreads};
+
+    size_t first = 0;
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        const size_t last = (i == nThreads - 1)
+                ? size
+                : (first + size / nThreads);
+
+        threads.spawn(i, [&fn, i, first, last] () { fn(i, first, last); });
+
+        // Next thread picks up where this thread left
+        first = last;
+    }
+
+    // Wait for all ranges to be processed
+    threads.join();
+}
+
+} // namespace internal
+
+namespace collectors {
+
+/**
+ * @brief Accumulator of the Tee collector
+ * @ingroup collectors
+ * 
+ */
+template<typename... Cs>
+struct TeeAccumulator
+{
+    using Accumulators = std::tuple<typename Cs::AccumulatorType...>;
+
+    /// Accumulator of each collector
+    Accumulators accumulators;
+    /// Accumulators combined into this one, in order: they are combined by
+    /// finish, where each collector can be processed by a different thread.
+    /// Each one is followed by the accumulators that were combined into it
+    std::vector<Accumulators> pending;
+    /// Number of accumulators that follow each pending one and were combined
+    /// into it, so that finish replays the tree of combinations
+    std::vector<size_t> nCombined;
+};
+
+/**
+ * @brief Feed each element of the stream to several collectors, and get the
+ * result of each of them
+ * @ingroup collectors
+ * 
+ * @details
+ * Each element is computed once for all the collectors. When the
+ * accumulators of several threads are combined, each collector combines and
+ * finishes its accumulators in its own thread, in the same tree as the
+ * accumulators were combined (so @ref{Ctream::deterministic} collects keep
+ * their pairwise combination).
+ * 
+ * @tparam T Type of the input elements
+ * @tparam Cs Types of the collectors
+ */
+template<typename T, typename... Cs>
+class Tee : public Collector<T, TeeAccumulator<Cs...>, std::tuple<typename Cs::ReturnType...>>
+{
+public:
+    using Accumulator = TeeAccumulator<Cs...>;
+    using Results = std::tuple<typename Cs::ReturnType...>;
+
+    Tee(const Cs&... collectors) : m_collectors{collectors...}
+    {
+    }
+
+    Accumulator supply() const override
+    {
+        return supply(Indices{});
+    }
+    void accumulate(Accumulator& a, const T& b) const override
+    {
+        accumulate(a, b, Indices{});
+    }
+    void accumulate(Accumulator& a, T&& b) const override
+    {
+        accumulate(a, std::move(b), Indices{});
+    }
+    void combine(Accumulator& a, Accumulator& b) const override
+    {
+        a.pending.emplace_back(std::move(b.accumulators));
+        a.nCombined.emplace_back(b.pending.size());
+        for (auto& pending : b.pending)
+            a.pending.emplace_back(std::move(pending));
+        a.nCombined.insert(a.nCombined.end(), b.nCombined.begin(), b.nCombined.end());
+        b.pending.clear();
+        b.nCombined.clear();
+    }
+    Results finish(Accumulator& a) const override
+    {
+        return finish(a, Indices{});
+    }
+
+private:
+    static constexpr size_t N = sizeof...(Cs);
+    using Indices = typename internal::MakeIndexSequence<N>::type;
+    using Outputs = std::tuple<std::unique_ptr<typename Cs::ReturnType>...>;
+
+    std::tuple<Cs...> m_collectors;
+
+    template<size_t... I>
+    Accumulator supply(internal::IndexSequence<I...>) const
+    {
+        return Accumulator{typename Accumulator::Accumulators{
+                std::get<I>(m_collectors).supply()...}, {}, {}};
+    }
+
+    template<size_t... I>
+    void accumulate(Accumulator& a, const T& b, internal::IndexSequence<I...>) const
+    {
+        using Expand = int[];
+        (void)Expand{0, (std::get<I>(m_collectors).accumulate(
+                std::get<I>(a.accumulators), b), 0)...};
+    }
+
+    /// Feed a copy of the element to all the collectors but the last one,
+    /// which can move it
+    template<size_t... I>
+    void accumulate(Accumulator& a, T&& b, internal::IndexSequence<I...>) const
+    {
+        using Expand = int[];
+        (void)Expand{0, (feed<I>(a, b, std::integral_constant<bool, I + 1 == N>()), 0)...};
+    }
+
+    template<size_t I>
+    void feed(Accumulator& a, T& b, std::false_type) const
+    {
+        std::get<I>(m_collectors).accumulate(std::get<I>(a.accumulators),
+                                             static_cast<const T&>(b));
+    }
+
+    template<size_t I>
+    void feed(Accumulator& a, T& b, std::true_type) const
+    {
+        std::get<I>(m_collectors).accumulate(std::get<I>(a.accumulators), std::move(b));
+    }
+
+    /// Combine the pending accumulators [first, last) of collector I into
+    /// accumulator, in the order and tree they were combined in
+    template<size_t I>
+    void combinePending(Accumulator& a,
+                        typename std::tuple_element<I, typename Accumulator::Accumulators>::type& accumulator,
+                        size_t first,
+                        size_t last) const
+    {
+        const auto& collector = std::get<I>(m_collectors);
+        for (size_t p = first; p < last; p += 1 + a.nCombined[p])
+        {
+            auto& pending = std::get<I>(a.pending[p]);
+            combinePending<I>(a, pending, p + 1, p + 1 + a.nCombined[p]);
+            collector.combine(accumulator, pending);
+        }
+    }
+
+    /// Combine the pending accumulators of collector I, and finish it
+    template<size_t I>
+    void finishOne(Accumulator& a, Outputs& outputs) const
+    {
+        const auto& collector = std::get<I>(m_collectors);
+        auto& accumulator = std::get<I>(a.accumulators);
+        combinePending<I>(a, accumulator, 0, a.pending.size());
+        std::get<I>(outputs).reset(
+                new typename std::tuple_element<I, Results>::type(collector.finish(accumulator)));
+    }
+
+    template<size_t... I>
+    Results finish(Accumulator& a, internal::IndexSequence<I...>) const
+    {
+        using Task = void (Tee::*)(Accumulator&, Outputs&) const;
+        const Task tasks[] = {&Tee::finishOne<I>...};
+        Outputs outputs;
+
+        // Accumulators were only combined if the stream was collected by
+        // several threads
+        if (a.pending.empty() || N < 2)
+        {
+            for (const Task task : tasks)
+                (this->*task)(a, outputs);
+        }
+        else
+        {
+            internal::WorkerThreads threads{N};
+            for (size_t i = 0; i < N; ++i)
+            {
+                const Task task = tasks[i];
+                threads.spawn(i, [this, task, &a, &outputs] () { (this->*task)(a, outputs); });
+            }
+            threads.join();
+        }
+        a.pending.clear();
+        a.nCombined.clear();
+        return Results{std::move(*std::get<I>(outputs))...};
+    }
+};
+
+template<typename T, typename... Cs>
+constexpr size_t Tee<T, Cs...>::N;
+
+} // namespace collectors
+
+namespace internal
+{
+
+/**
+ * @brief Hash table built from the elements of a stream, used by lookup joins
+ *
+ * @details
+ * The table is split into partitions by key hash so that the partitions can
+ * be filled in parallel without locking. The keys must be unique: building
+ * the table throws std::invalid_argument when several elements share a key.
+ *
+ * @tparam K Key type
+ * @tparam U Type of the stored elements
+ */
+template<typename K, typename U>
+class JoinTable
+{
+public:
+    /// Look for the element with the given key (nullptr if there is none)
+    const U* find(const K& key) const
+    {
+        const auto& partition = m_partitions[partitionOf(key)];
+        auto it = partition.find(key);
+        if (it == partition.end())
+            return nullptr;
+        return &it->second;
+    }
+
+    /// Fill the table with the elements of a stream, keyed by keyFn, the
+    /// first time it is called
+    void buildOnce(const Ctream<U>& stream, const std::function<K(const U&)>& keyFn)
+    {
+        std::call_once(m_built, [this, &stream, &keyFn] ()
+        {
+            stream.prepare();
+            build(stream, keyFn);
+        });
+    }
+
+    /// Fill the table with the elements of a stream, keyed by keyFn
+    void build(const Ctream<U>& stream, const std::function<K(const U&)>& keyFn)
+    {
+        stream.consumeSource();
+        const size_t size = stream.m_containerSize;
+        const size_t nThreads = threadsFor(size, stream.m_maxThreads);
+
+        // One partition per thread
+        m_partitions.clear();
+        m_partitions.resize(nThreads);
+
+        // Scatter the elements into per-thread, per-partition buckets
+        using Bucket = std::vector<std::pair<K, U>>;
+        std::vector<std::vector<Bucket>> buckets(
+                nThreads, std::vector<Bucket>(nThreads));
+        parallelFor(size, nThreads,
+                [this, &stream, &keyFn, &buckets]
+                (size_t t, size_t first, size_t last)
+        {
+            const RunArenas::Lease lease{*stream.m_runArenas};
+            RunArenaScope scope{lease.arena()};
+            auto& threadBuckets = buckets[t];
+            for (size_t j = first; j < last; ++j)
+            {
+                const U* item = stream.computeItem(j);
+                if (!item)
+                    continue;
+                K key = keyFn(*item);
+                threadBuckets[partitionOf(key)].emplace_back(std::move(key), *item);
+            }
+        });
+
+        // Each thread builds a partition from the buckets, in source order
+        parallelFor(nThreads, nThreads,
+                [this, &buckets] (size_t, size_t first, size_t last)
+        {
+            for (size_t p = first; p < last; ++p)
+            {
+                size_t count = 0;
+                for (const auto& threadBuckets : buckets)
+                    count += threadBuckets[p].size();
+
+                auto& partition = m_partitions[p];
+                partition.reserve(count);
+                for (auto& threadBuckets : buckets)
+                {
+                    for (auto& kv : threadBuckets[p])
+                    {
+                        if (!partition.emplace(std::move(kv.first), std::move(kv.second)).second)
+                            throw std::invalid_argument("Duplicate key in a lookup join");
+                    }
+
+                    // Release the bucket as soon as it is not needed anymore
+                    Bucket{}.swap(threadBuckets[p]);
+                }
+            }
+        });
+    }
+
+private:
+    std::vector<std::unordered_map<K, U>> m_partitions{};
+    std::hash<K> m_hash{};
+    std::once_flag m_built{};
+
+    size_t partitionOf(const K& key) const
+    {
+        return m_hash(key) % m_partitions.size();
+    }
+};
+
+/**
+ * @brief Hash tables of the lookup joins of a compiled pipeline, kept when the
+ * pipeline is built again for a new source
+ *
+ * @details
+ * The joins of each build get the tables of the joins of the previous builds,
+ * in order, so that the tables of streams that do not depend on the source
+ * of the pipeline are only built once.
+ */
+class JoinTables
+{
+public:
+    /// Start a new build of the pipeline
+    void rewind()
+    {
+        m_next = 0;
+    }
+
+    /// Table of the next join of the build (a new one if the table of the
+    /// previous builds cannot be reused)
+    template<typename Table>
+    std::shared_ptr<Table> next(bool reuse)
+    {
+        const size_t i = m_next++;
+        if (i == m_tables.size())
+            m_tables.emplace_back(nullptr, nullptr);
+        auto& entry = m_tables[i];
+        if (!reuse || entry.second != &typeid(Table))
+            entry = Entry{std::make_shared<Table>(), &typeid(Table)};
+        return std::static_pointer_cast<Table>(entry.first);
+    }
+
+private:
+    using Entry = std::pair<std::shared_ptr<void>, const std::type_info*>;
+
+    std::vector<Entry> m_tables{};
+    size_t m_next{0};
+};
+
+/**
+ * @brief Prefix scan of the elements of a stream, computed in parallel
+ *
+ * @details
+ * The scan is computed in three passes over the chunks used by collect: a
+ * local scan of each chunk, a prefix of the chunk totals, then a fix-up of
+ * each chunk with the total of the chunks before it. The elements that are
+ * filtered out of the stream keep their position, so that the scanned values
+ * have the same indices as the stream elements.
+ *
+ * @tparam T Type of the elements
+ */
+template<typename T>
+class ScanResult
+{
+public:
+    /// Scanned value at position i (nullptr if the element was filtered out)
+    const T* at(size_t i) const
+    {
+        return m_survivors[i] ? &m_values[i] : nullptr;
+    }
+
+    /// Compute the scan of the elements of a stream
+    void compute(const Ctream<T>& stream,
+                 const T& init,
+                 const std::function<T(const T&, const T&)>& op,
+                 bool inclusive)
+    {
+        stream.consumeSource();
+        const size_t size = stream.m_containerSize;
+        const size_t nThreads = threadsFor(size, stream.m_maxThreads);
+
+        m_values.assign(size, T{});
+        m_survivors.assign(size, 0);
+
+        // Local scan of each chunk
+        std::vector<Optional<T>> totals(nThreads);
+        parallelFor(size, nThreads,
+                [this, &stream, &op, &totals] (size_t t, size_t first, size_t last)
+        {
+            const RunArenas::Lease lease{*stream.m_runArenas};
+            RunArenaScope scope{lease.arena()};
+            Optional<T> total;
+            for (size_t j = first; j < last; ++j)
+            {
+                const T* item = stream.computeItem(j);
+                if (!item)
+                    continue;
+                total = total ? op(total.value(), *item) : *item;
+                m_values[j] = total.value();
+                m_survivors[j] = 1;
+            }
+            totals[t] = total;
+        });
+
+        // Prefix of the chunk totals: carries[t] is what comes before chunk t
+        std::vector<T> carries;
+        carries.reserve(nThreads);
+        carries.emplace_back(init);
+        for (size_t t = 0; t + 1 < nThreads; ++t)
+        {
+            if (totals[t])
+                carries.emplace_back(op(carries.back(), totals[t].value()));
+            else
+                carries.emplace_back(carries.back());
+        }
+
+        // Fix-up of each chunk with its carry
+        parallelFor(size, nThreads,
+                [this, &op, &carries, inclusive] (size_t t, size_t first, size_t last)
+        {
+            const T& carry = carries[t];
+            Optional<T> previous;
+            for (size_t j = first; j < last; ++j)
+            {
+                if (!m_survivors[j])
+                    continue;
+                if (inclusive)
+                {
+                    m_values[j] = op(carry, m_values[j]);
+                }
+                else
+                {
+                    T local = std::move(m_values[j]);
+                    m_values[j] = previous ? op(carry, previous.value()) : carry;
+                    previous = local;
+                }
+            }
+        });
+    }
+
+private:
+    std::vector<T> m_values{};
+    std::vector<char> m_survivors{};
+};
+
+/**
+ * @brief Elements of a stream evaluated once, in a contiguous buffer
+ *
+ * @details
+ * The elements keep their position in the stream. A bitmap of one bit per
+ * position records the elements that were not filtered out, and is dropped
+ * if none was. Each thread evaluates the positions of whole words of the
+ * bitmap, so that it is filled without atomics. The elements that the
+ * pipeline creates are built in a scratch arena that is reset after each
+ * block of positions, and moved into the buffer.
+ *
+ * @tparam T Type of the elements
+ */
+template<typename T>
+class CacheResult
+{
+public:
+    CacheResult() = default;
+    CacheResult(const CacheResult&) = delete;
+    CacheResult& operator=(const CacheResult&) = delete;
+    ~CacheResult()
+    {
+        clear();
+    }
+
+    /// Element at position i (nullptr if it was filtered out)
+    const T* at(size_t i) const
+    {
+        if (!m_survivors.empty() && !((m_survivors[i / 64] >> (i % 64)) & 1))
+            return nullptr;
+        return reinterpret_cast<const T*>(&m_storage[i]);
+    }
+
+    /// Evaluate the elements of a stream
+    void compute(const Ctream<T>& stream)
+    {
+        stream.consumeSource();
+        clear();
+        const size_t size = stream.m_containerSize;
+        const size_t nWords = (size + 63) / 64;
+        const size_t nThreads = std::min(threadsFor(size, stream.m_maxThreads),
+                                         std::max(nWords, size_t(1)));
+
+        m_storage.reset(new Storage[size]);
+        m_size = size;
+        m_survivors.assign(nWords, 0);
+
+        std::vector<char> filtered(nThreads, 0);
+        parallelFor(nWords, nThreads,
+                [this, &stream, &filtered] (size_t t, size_t firstWord, size_t lastWord)
+        {
+            const RunArenas::Lease lease{*stream.m_runArenas};
+            Arena& scratch = lease.arena();
+            RunArenaScope scope{scratch};
+            for (size_t w = firstWord; w < lastWord; w += WORDS_PER_BLOCK)
+            {
+                const size_t last = std::min((w + WORDS_PER_BLOCK) * 64,
+                                             std::min(lastWord * 64, m_size));
+                for (size_t j = w * 64; j < last; ++j)
+                {
+                    const T* item = stream.computeItem(j);
+                    if (!item)
+                    {
+                        filtered[t] = 1;
+                        continue;
+                    }
+                    if (stream.m_movableItems)
+                        new (&m_storage[j]) T(std::move(*const_cast<T*>(item)));
+                    else
+                        new (&m_storage[j]) T(*item);
+                    m_survivors[j / 64] |= std::uint64_t(1) << (j % 64);
+                }
+                scratch.reset();
+            }
+        });
+
+        if (std::find(filtered.begin(), filtered.end(), 1) == filtered.end())
+            std::vector<std::uint64_t>{}.swap(m_survivors);
+    }
+
+private:
+    using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    /// Number of words of the bitmap evaluated between two resets of the
+    /// scratch arena
+    static constexpr size_t WORDS_PER_BLOCK = 64;
+
+    std::unique_ptr<Storage[]> m_storage{};
+    size_t m_size{0};
+    /// Bitmap of the elements that were not filtered out (empty if all
+    /// elements were kept)
+    std::vector<std::uint64_t> m_survivors{};
+
+    /// Destroy the elements (the ones marked in the bitmap, if any)
+    void clear()
+    {
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                if (at(i))
+                    reinterpret_cast<T*>(&m_storage[i])->~T();
+            }
+        }
+        m_storage.reset();
+        m_size = 0;
+        m_survivors.clear();
+    }
+};
+
+template<typename T>
+constexpr size_t CacheResult<T>::WORDS_PER_BLOCK;
+
+/**
+ * @brief Aggregates of the windows of a stream, computed in parallel
+ *
+ * @details
+ * The elements of the stream are materialized in order, then the windows are
+ * split into contiguous ranges that are processed by separate threads.
+ * Tumbling windows (step >= size) are aggregated independently. Sliding
+ * windows are aggregated with two stacks when the accumulators can be copied:
+ * a back accumulator of the most recent elements, and suffix aggregates of
+ * the older elements that are rebuilt whenever the window leaves them, so
+ * that each element is accumulated a constant number of times.
+ *
+ * @tparam T Type of the elements
+ * @tparam C Type of the collector applied to each window
+ */
+template<typename T, typename C>
+class WindowResult
+{
+public:
+    using A = typename C::AccumulatorType;
+    using R = typename C::ReturnType;
+
+    WindowResult(size_t size, size_t step, const C& collector)
+        : m_size(size), m_step(step), m_collector(collector)
+    {}
+
+    /// Aggregate of window i (nullptr if the stream has less windows)
+    const R* at(size_t i) const
+    {
+        return i < m_windows.size() ? &m_windows[i] : nullptr;
+    }
+
+    /// Compute the aggregates of the windows of a stream
+    void compute(const Ctream<T>& stream)
+    {
+        const std::vector<T> elements = stream.toVector();
+        if (elements.size() < m_size)
+            return;
+
+        const size_t nWindows = (elements.size() - m_size) / m_step + 1;
+        const size_t nThreads = std::min(
+                threadsFor(elements.size(), stream.m_maxThreads), nWindows);
+
+        std::vector<std::vector<R>> chunks(nThreads);
+        parallelFor(nWindows, nThreads,
+                [this, &elements, &chunks] (size_t t, size_t first, size_t last)
+        {
+            chunks[t].reserve(last - first);
+            if (m_step >= m_size)
+                aggregateEach(elements, first, last, chunks[t]);
+            else
+                aggregateSliding(elements, first, last, chunks[t],
+                                 std::is_copy_constructible<A>());
+        });
+
+        m_windows.reserve(nWindows);
+        for (auto& chunk : chunks)
+            for (auto& window : chunk)
+                m_windows.emplace_back(std::move(window));
+    }
+
+private:
+    size_t m_size;
+    size_t m_step;
+    C m_collector;
+    std::vector<R> m_windows{};
+
+    /// Aggregate windows [first, last) independently of each other
+    void aggregateEach(const std::vector<T>& elements,
+                       size_t first, size_t last, std::vector<R>& out) const
+    {
+        for (size_t w = first; w < last; ++w)
+        {
+            const size_t begin = w * m_step;
+            A a = supplyAt(m_collector, begin);
+            for (size_t j = begin; j < begin + m_size; ++j)
+                m_collector.accumulate(a, elements[j]);
+            out.emplace_back(m_collector.finish(a));
+        }
+    }
+
+    /// Accumulators that cannot be copied cannot be reused across windows
+    void aggregateSliding(const std::vector<T>& elements,
+                          size_t first, size_t last, std::vector<R>& out,
+                          std::false_type) const
+    {
+        aggregateEach(elements, first, last, out);
+    }
+
+    /// Aggregate windows [first, last) with two stacks
+    void aggregateSliding(const std::vector<T>& elements,
+                          size_t first, size_t last, std::vector<R>& out,
+                          std::true_type) const
+    {
+        // suffixes[k] aggregates elements [base + k, mid), and back aggregates
+        // elements [mid, end)
+        std::vector<A> suffixes;
+        size_t base = first * m_step;
+        size_t mid = base;
+        size_t end = base;
+        A back = supplyAt(m_collector, base);
+
+        for (size_t w = first; w < last; ++w)
+        {
+            const size_t begin = w * m_step;
+            if (begin >= mid)
+            {
+                // The window left the suffixes: rebuild them from the back
+                suffixes.clear();
+                suffixes.reserve(end - begin);
+                for (size_t j = end; j > begin; --j)
+                {
+                    A a = supplyAt(m_collector, j - 1);
+                    m_collector.accumulate(a, elements[j - 1]);
+                    if (j < end)
+                    {
+                        A next = suffixes.back();
+                        m_collector.combine(a, next);
+                    }
+                    suffixes.emplace_back(std::move(a));
+                }
+                std::reverse(suffixes.begin(), suffixes.end());
+                base = begin;
+                mid = end;
+                back = supplyAt(m_collector, end);
+            }
+
+            for (; end < begin + m_size; ++end)
+                m_collector.accumulate(back, elements[end]);
+
+            if (begin < mid)
+            {
+                A a = suffixes[begin - base];
+                A tail = back;
+                m_collector.combine(a, tail);
+                out.emplace_back(m_collector.finish(a));
+            }
+            else
+            {
+                A a = back;
+                out.emplace_back(m_collector.finish(a));
+            }
+        }
+    }
+};
+
+/**
+ * @defgroup ctream Ctream API
+ * @details
+ * This group contains templated class Ctream which is the entrypoint of this
+ * library.
+ * 
+ * Ctream provides a clear syntax and parallelized implementation for inline
+ * data manipulation. Ctream objects can be created using diverse STL
+ * containers as source, then modified through data mapping extraction and
+ * filtering, and then exported using @ref{Collector} objects into usable
+ * types.
+ * 
+ * @{
+ */
+
+/**
+ * @brief Pipeline for data manipulation
+ * 
+ * @tparam T Type of the streamed elements
+ */
+template<typename T>
+class Ctream
+{
+public:
+    using SourceDataRetriever = std::function<void const*(size_t)>;
+    using PipelineStep = std::function<void const*(void const*)>;
+
+    /**
+     * @name Create from STL containers
+     * @{
+     */
+
+    /**
+     * @brief Construct from a vector
+     * 
+     * @param values Vector containing the values to stream
+     */
+    Ctream(const std::vector<T>& values)
+            : m_sourceData{[&values] (size_t i) { return &values.at(i); }}
+            , m_containerSize{values.size()}
+    {
+    }
+
+    /**
+     * @brief Construct from a list
+     * 
+     * @param values List containing the values to stream
+     */
+    Ctream(const std::list<T>& values)
+            : m_containerSize{values.size()}
+            , m_prefetchDistance{fine_tuning::INDIRECT_PREFETCH_DISTANCE}
+    {
+        indexList(values);
+    }
+
+    /**
+     * @brief Construct from a C array
+     * 
+     * @param values Array containing the values to stream
+     * @param size Number of elements in the array
+     */
+    Ctream(const T* values, size_t size)
+            : m_sourceData{[values] (size_t i) { return &values[i]; }}
+            , m_containerSize{size}
+    {
+    }
+
+    /**
+     * @brief Construct from a vector, taking ownership of its elements
+     * 
+     * @details
+     * The elements are moved (instead of copied) into the result of the
+     * first collect, so such a stream can only be collected once: the next
+     * collects throw std::logic_error.
+     * 
+     * @param values Vector containing the values to stream
+     */
+    Ctream(std::vector<T>&& values)
+            : m_containerSize{values.size()}
+            , m_sourceConsumed{std::make_shared<std::atomic<bool>>(false)}
+            , m_movableItems{true}
+            , m_sourceItems{true}
+            , m_movesSource{true}
+    {
+        // The vector lives in the arena, which is shared by the whole pipeline
+        const std::vector<T>* owned =
+                m_arena->construct<std::vector<T>>(std::move(values));
+        m_sourceData = [owned] (size_t i) { return &(*owned)[i]; };
+    }
+
+    /**
+     * @brief Construct from a list, taking ownership of its elements
+     * 
+     * @details
+     * The elements are moved (instead of copied) into the result of the
+     * first collect, so such a stream can only be collected once: the next
+     * collects throw std::logic_error.
+     * 
+     * @param values List containing the values to stream
+     */
+    Ctream(std::list<T>&& values)
+            : m_containerSize{values.size()}
+            , m_prefetchDistance{fine_tuning::INDIRECT_PREFETCH_DISTANCE}
+            , m_sourceConsumed{std::make_shared<std::atomic<bool>>(false)}
+            , m_movableItems{true}
+            , m_sourceItems{true}
+            , m_movesSource{true}
+    {
+        indexList(*m_arena->construct<std::list<T>>(std::move(values)));
+    }
+
+    /** @} */
+
+    // Internal constructor please do not use
+    Ctream(size_t containerSize, const SourceDataRetriever& sourceData)
+            : m_sourceData{sourceData}
+            , m_containerSize{containerSize}
+    {
+    }
+
+    // Internal constructor please do not use
+    template<typename P>
+    Ctream(const Ctream<P>& previous, const PipelineStep& newPipelineStep)
+            : m_arena{previous.m_arena}
+            , m_runArenas{previous.m_runArenas}
+            , m_sourceData{previous.m_sourceData}
+            , m_pipeline{previous.m_pipeline}
+            , m_containerSize{previous.m_containerSize}
+            , m_preparations{previous.m_preparations}
+            , m_sourcePreparations{previous.m_sourcePreparations}
+            , m_joinTables{previous.m_joinTables}
+            , m_maxThreads{previous.m_maxThreads}
+            , m_topology{previous.m_topology}
+            , m_blockSize{previous.m_blockSize}
+            , m_prefetchDistance{previous.m_prefetchDistance}
+            , m_prefetchAddress{previous.m_prefetchAddress}
+            , m_sourceConsumed{previous.m_sourceConsumed}
+            , m_movableItems{previous.m_movableItems}
+            , m_sourceItems{previous.m_sourceItems}
+            , m_movesSource{previous.m_movesSource}
+            , m_sourceSized{previous.m_sourceSized}
     {
         m_pipeline.emplace_back(newPipelineStep);
     }
 
     /**
-     * @name Manipulate the data in the stream
-     * @{
+     * @name Manipulate the data in the stream
+     * @{
+     */
+
+    /**
+     * @brief Remove from the stream the elements that do not match a filter
+     * 
+     * @param filter A condition on a stream element. The element remains in
+     * the stream if and only if it matches the filter
+     * @return Ctream<T> A stream with only the filtered data
+     */
+    Ctream<T> filter(const std::function<bool(const T&)> filter) const
+    {
+        PipelineStep newPipelineStep = [filter] (const void* elt)
+        {
+            if (filter(*reinterpret_cast<const T*>(elt)))
+                return elt;
+            return (void const*)(0);
+        };
+        return Ctream<T>(*this, newPipelineStep);
+    }
+
+    /**
+     * @brief Keep each element of the stream with probability p, independently
+     * of the other elements (Bernoulli sampling)
+     * 
+     * @details
+     * The positions of the kept elements are drawn when the stream is created,
+     * by jumping over the skipped positions with geometric draws, so that
+     * skipped elements are never computed. The sample only depends on the
+     * seed and on the size of the source.
+     * 
+     * @param p Probability of keeping each element
+     * @param seed Seed of the random draws
+     * @return Ctream<T> A stream with only the sampled elements
+     */
+    Ctream<T> bernoulli(double p, std::uint64_t seed) const
+    {
+        auto positions = std::make_shared<std::vector<size_t>>();
+        positions->reserve(size_t(std::max(0.0, std::min(p, 1.0)) * m_containerSize));
+
+        Random random{seed};
+        for (size_t i = 0; ; ++i)
+        {
+            const std::uint64_t skip = random.geometric(p);
+            if (skip >= m_containerSize - i)
+                break;
+            i += size_t(skip);
+            positions->emplace_back(i);
+        }
+
+        Ctream<T> out = *this;
+        const SourceDataRetriever source = m_sourceData;
+        out.m_sourceData = [source, positions] (size_t i)
+        {
+            return source((*positions)[i]);
+        };
+        out.m_containerSize = positions->size();
+        out.m_sourceSized = false;
+        return out;
+    }
+
+    /**
+     * @brief Extract data from the elements of the stream.
+     * 
+     * @details
+     * When the data can be extracted by reference from the elements, this is
+     * better than @ref{map} because is does not copy and construct new elements
+     * 
+     * @tparam U The type of the extracted data
+     * @param extractor A function that, given an element of the stream,
+     * returns a const reference to type U data
+     * @return Ctream<U> A stream with the extracted data
+     */
+    template<typename U>
+    Ctream<U> extract(const std::function<const U&(const T&)>& extractor) const
+    {
+        PipelineStep newPipelineStep = [extractor] (const void* elt)
+        {
+            return &extractor(*reinterpret_cast<const T*>(elt));
+        };
+        Ctream<U> out(*this, newPipelineStep);
+
+        // The extracted data may be referenced by something else
+        out.m_movableItems = false;
+        out.replacesElements();
+        return out;
+    }
+
+    /**
+     * @brief Transform the data from the elements in the stream.
+     * 
+     * @details
+     * If the mapper you want to use can return a const reference, it is
+     * preferable to use @ref{extract} instead to avoid overhead
+     * 
+     * @tparam U The type of the transformed data
+     * @param mapper A function that, given an element of the stream,
+     * returns an element of type U
+     * @return Ctream<U> A stream with the transformed data
+     */
+    template<typename U>
+    Ctream<U> map(const std::function<U(const T&)>& mapper) const
+    {
+        Arena* arena = m_arena.get();
+        PipelineStep newPipelineStep = [arena, mapper] (const void* elt)
+        {
+            return constructElement<U>(*arena, mapper(*reinterpret_cast<const T*>(elt)));
+        };
+        Ctream<U> out(*this, newPipelineStep);
+
+        // The transformed data is only used by the next steps
+        out.m_movableItems = true;
+        out.replacesElements();
+        return out;
+    }
+
+    /**
+     * @brief Cast the elements of the stream into a new type by construction.
+     * 
+     * @tparam U The type of the transformed data
+     * @return Ctream<U> A stream with the transformed data
+     */
+    template<typename U>
+    Ctream<U> map() const
+    {
+        Arena* arena = m_arena.get();
+        PipelineStep newPipelineStep;
+        if (m_movableItems)
+        {
+            newPipelineStep = [arena] (const void* elt)
+            {
+                return constructElement<U>(*arena,
+                        std::move(*reinterpret_cast<T*>(const_cast<void*>(elt))));
+            };
+        }
+        else
+        {
+            newPipelineStep = [arena] (const void* elt)
+            {
+                return constructElement<U>(*arena, *reinterpret_cast<const T*>(elt));
+            };
+        }
+        Ctream<U> out(*this, newPipelineStep);
+
+        // The transformed data is only used by the next steps (the source
+        // elements may have been moved into it)
+        out.m_movableItems = true;
+        out.m_sourceItems = false;
+        return out;
+    }
+
+    /**
+     * @brief Join each element of the stream with the element of another
+     * stream that has the same key (inner lookup join)
+     * 
+     * @details
+     * A hash table is built in parallel from the other stream the first time
+     * the resulting stream is collected, then each element of this stream
+     * looks up its match from the collecting threads. Elements without a
+     * match are removed from the stream.
+     * 
+     * Each element of this stream gives at most one joined element, so the
+     * other stream is a lookup table: it is the one stored in the hash table
+     * (whatever the sizes of the streams), and its keys must be unique. The
+     * collect throws std::invalid_argument when several of its elements share
+     * a key.
+     * 
+     * @tparam K Type of the join key (must be hashable with std::hash)
+     * @tparam R Type of the joined elements
+     * @tparam U Type of the elements of the other stream
+     * @param other Stream to join with
+     * @param leftKey A function that returns the key of an element of this
+     * stream
+     * @param rightKey A function that returns the key of an element of the
+     * other stream
+     * @param combiner A function that builds a joined element from two
+     * elements with the same key
+     * @return Ctream<R> A stream with the joined elements
+     */
+    template<typename K, typename R, typename U>
+    Ctream<R> lookupJoin(const Ctream<U>& other,
+                         const typename NonDeduced<std::function<K(const T&)>>::type& leftKey,
+                         const typename NonDeduced<std::function<K(const U&)>>::type& rightKey,
+                         const typename NonDeduced<std::function<R(const T&, const U&)>>::type& combiner) const
+    {
+        auto table = joinTable<K, U>(other);
+        Arena* arena = m_arena.get();
+        PipelineStep newPipelineStep = [arena, table, leftKey, combiner]
+                (const void* elt)
+        {
+            const T& left = *reinterpret_cast<const T*>(elt);
+            const U* right = table->find(leftKey(left));
+            if (!right)
+                return (void const*)(0);
+            return (void const*)(constructElement<R>(*arena, combiner(left, *right)));
+        };
+        return joined<K, R, U>(other, rightKey, table, newPipelineStep);
+    }
+
+    /**
+     * @brief Join each element of the stream with the element of another
+     * stream that has the same key, keeping the elements without a match
+     * (left outer lookup join)
+     * 
+     * @details
+     * Same as @ref{lookupJoin}, except that the elements of this stream that have
+     * no match are kept: the combiner receives nullptr for them.
+     * 
+     * @tparam K Type of the join key (must be hashable with std::hash)
+     * @tparam R Type of the joined elements
+     * @tparam U Type of the elements of the other stream
+     * @param other Stream to join with
+     * @param leftKey A function that returns the key of an element of this
+     * stream
+     * @param rightKey A function that returns the key of an element of the
+     * other stream
+     * @param combiner A function that builds a joined element from an element
+     * of this stream and its match (nullptr if there is none)
+     * @return Ctream<R> A stream with the joined elements
+     */
+    template<typename K, typename R, typename U>
+    Ctream<R> leftLookupJoin(const Ctream<U>& other,
+                             const typename NonDeduced<std::function<K(const T&)>>::type& leftKey,
+                             const typename NonDeduced<std::function<K(const U&)>>::type& rightKey,
+                             const typename NonDeduced<std::function<R(const T&, const U*)>>::type& combiner) const
+    {
+        auto table = joinTable<K, U>(other);
+        Arena* arena = m_arena.get();
+        PipelineStep newPipelineStep = [arena, table, leftKey, combiner]
+                (const void* elt)
+        {
+            const T& left = *reinterpret_cast<const T*>(elt);
+            const U* right = table->find(leftKey(left));
+            return (void const*)(constructElement<R>(*arena, combiner(left, right)));
+        };
+        return joined<K, R, U>(other, rightKey, table, newPipelineStep);
+    }
+
+    /**
+     * @brief Limit the number of threads used to process the stream
+     * 
+     * @details
+     * The limit applies to this stream and to the streams created from it.
+     * Small streams may still use fewer threads.
+     * 
+     * @param maxThreads Maximum number of threads (0 for the default limit)
+     * @return Ctream<T> The same stream, with the new limit
+     */
+    Ctream<T> parallelism(size_t maxThreads) const
+    {
+        Ctream<T> out = *this;
+        out.m_maxThreads = maxThreads;
+        return out;
+    }
+
+    /**
+     * @brief Prefetch the source elements ahead of the ones being collected
+     * 
+     * @details
+     * While collecting the element at position i, each thread asks the
+     * processor to load the source element at position i + distance, so that
+     * it is in cache when it is processed. This helps when the source elements
+     * are scattered in memory (e.g. lists, for which the default distance is
+     * fine_tuning::INDIRECT_PREFETCH_DISTANCE), and costs a source lookup per
+     * element otherwise. The benchmark tool measures the best distance for
+     * each kind of source (--tune-prefetch). The setting applies to this
+     * stream and to the streams created from it.
+     * 
+     * @param distance Prefetch distance, in positions (0 to disable
+     * prefetching)
+     * @return Ctream<T> The same stream, with the new prefetch distance
+     */
+    Ctream<T> prefetch(size_t distance) const
+    {
+        Ctream<T> out = *this;
+        out.m_prefetchDistance = distance;
+        return out;
+    }
+
+    /**
+     * @brief Prefetch data reached from the source elements ahead of the ones
+     * being collected
+     * 
+     * @details
+     * Same as @ref{prefetch}, but the prefetched address is given by a
+     * function of the source element (e.g. the object it points to, when the
+     * stream then extracts data from it). It can only be called on a stream
+     * without pipeline steps, whose elements are the source elements.
+     * 
+     * @param distance Prefetch distance, in positions (0 to disable
+     * prefetching)
+     * @param address Function that returns the address to prefetch for a
+     * source element (it must not dereference anything that is not in cache
+     * already, or prefetching is pointless)
+     * @return Ctream<T> The same stream, with the new prefetch distance
+     * @throws std::logic_error If the stream has pipeline steps
+     */
+    Ctream<T> prefetch(size_t distance,
+                       const std::function<const void*(const T&)>& address) const
+    {
+        if (!m_pipeline.empty())
+            throw std::logic_error("Prefetch addresses must be set on the source stream");
+        Ctream<T> out = prefetch(distance);
+        out.m_prefetchAddress = [address] (const void* element)
+        {
+            return address(*reinterpret_cast<const T*>(element));
+        };
+        return out;
+    }
+
+    /**
+     * @brief Collect the stream in fixed blocks, so that the results do not
+     * depend on the number of threads
+     * 
+     * @details
+     * The elements are split into blocks of blockSize consecutive positions,
+     * each accumulated separately, and the accumulators of the blocks are
+     * combined pairwise in a fixed tree. Threads process runs of whole
+     * blocks. With floating-point collectors (e.g. @ref{collectors::Sum} or
+     * @ref{collectors::AccurateSum}), results are then the same with any
+     * number of threads. The setting applies to this stream and to the
+     * streams created from it, and takes precedence over @ref{numaAware}.
+     * 
+     * @param blockSize Number of positions of each block (0 to disable)
+     * @return Ctream<T> The same stream, collected deterministically
+     */
+    Ctream<T> deterministic(size_t blockSize = fine_tuning::DETERMINISTIC_BLOCK_SIZE) const
+    {
+        Ctream<T> out = *this;
+        out.m_blockSize = blockSize;
+        return out;
+    }
+
+    /**
+     * @brief Collect the stream with threads pinned to NUMA nodes
+     * 
+     * @details
+     * Each node processes the range of the source that its memory holds (when
+     * it can be determined), allocates its arena pages and accumulators
+     * locally, and combines its accumulators before they are combined across
+     * nodes (see @ref{numa}). The setting applies to this stream and to the
+     * streams created from it. A topology without nodes disables it.
+     * 
+     * @param topology NUMA nodes to use
+     * @return Ctream<T> The same stream, NUMA-aware
+     */
+    Ctream<T> numaAware(const numa::Topology& topology = numa::Topology::detect()) const
+    {
+        Ctream<T> out = *this;
+        if (topology.nodes.empty())
+            out.m_topology.reset();
+        else
+            out.m_topology = std::make_shared<numa::Topology>(topology);
+        return out;
+    }
+
+    /**
+     * @brief Replace each element of the stream by the combination of all the
+     * elements up to it, included (inclusive prefix scan)
+     * 
+     * @details
+     * The scan is computed in parallel the first time the resulting stream is
+     * collected, and can then be further filtered or transformed.
+     * 
+     * @param init Value combined before the first element
+     * @param op An associative operation combining two elements
+     * @return Ctream<T> A stream with the scanned values
+     */
+    Ctream<T> scan(const T& init,
+                   const std::function<T(const T&, const T&)>& op) const
+    {
+        return scanned(init, op, true);
+    }
+
+    /**
+     * @brief Replace each element of the stream by the combination of all the
+     * elements before it, excluded (exclusive prefix scan)
+     * 
+     * @details
+     * The scan is computed in parallel the first time the resulting stream is
+     * collected, and can then be further filtered or transformed.
+     * 
+     * @param init Value combined before the first element (and value of the
+     * first element)
+     * @param op An associative operation combining two elements
+     * @return Ctream<T> A stream with the scanned values
+     */
+    Ctream<T> exclusiveScan(const T& init,
+                            const std::function<T(const T&, const T&)>& op) const
+    {
+        return scanned(init, op, false);
+    }
+
+    /**
+     * @brief Evaluate the stream once, so that the streams created from it and
+     * their collects reuse its elements
+     * 
+     * @details
+     * The elements are evaluated in parallel the first time the resulting
+     * stream (or a stream created from it) is collected, and stored in a
+     * contiguous buffer, with a bitmap of the positions that were not
+     * filtered out. Later collects read them from the buffer instead of
+     * running the pipeline again, and the elements created by the pipeline
+     * (e.g. by a map) are not kept in the arena of the stream.
+     * 
+     * @return Ctream<T> A stream reading the evaluated elements
+     */
+    Ctream<T> cache() const
+    {
+        auto result = std::make_shared<CacheResult<T>>();
+        Ctream<T> out(m_containerSize, [result] (size_t i)
+        {
+            return (void const*)(result->at(i));
+        });
+        out.m_arena = m_arena;
+        out.m_runArenas = m_runArenas;
+        out.m_maxThreads = m_maxThreads;
+        out.m_topology = m_topology;
+        out.m_blockSize = m_blockSize;
+        out.m_joinTables = m_joinTables;
+        out.m_sourcePreparations = true;
+
+        // The elements are evaluated the first time the stream is collected
+        auto computed = std::make_shared<std::once_flag>();
+        const Ctream<T> upstream = *this;
+        out.m_preparations.emplace_back([computed, result, upstream] ()
+        {
+            std::call_once(*computed, [&result, &upstream] ()
+            {
+                upstream.prepare();
+                result->compute(upstream);
+            });
+        });
+        return out;
+    }
+
+    /**
+     * @brief Replace the elements of the stream by the aggregates of windows
+     * of consecutive elements
+     * 
+     * @details
+     * Window i contains the elements [i * step, i * step + size) of the
+     * stream, in order, without the elements that were filtered out. Only
+     * complete windows are aggregated: step >= size gives tumbling windows,
+     * and step < size gives sliding windows. The aggregates are computed in
+     * parallel the first time the resulting stream is collected.
+     * 
+     * @tparam C Type of the collector
+     * @param size Number of elements in each window (at least 1)
+     * @param step Number of elements between the starts of two consecutive
+     * windows (at least 1)
+     * @param collector Collector applied to each window
+     * @return Ctream<typename C::ReturnType> A stream with the aggregate of
+     * each window
+     */
+    template<typename C>
+    Ctream<typename C::ReturnType> window(size_t size,
+                                          size_t step,
+                                          const C& collector) const
+    {
+        static_assert(std::is_same<typename C::InputType, T>::value,
+                      "The collector must take the elements of the stream");
+
+        using R = typename C::ReturnType;
+        size = std::max(size, size_t(1));
+        step = std::max(step, size_t(1));
+
+        // Upper bound of the number of windows (if no element is filtered out)
+        const size_t nWindows = m_containerSize < size
+                ? 0
+                : (m_containerSize - size) / step + 1;
+
+        auto result = std::make_shared<WindowResult<T, C>>(size, step, collector);
+        Ctream<R> out(nWindows, [result] (size_t i)
+        {
+            return (void const*)(result->at(i));
+        });
+        out.m_arena = m_arena;
+        out.m_runArenas = m_runArenas;
+        out.m_maxThreads = m_maxThreads;
+        out.m_topology = m_topology;
+        out.m_blockSize = m_blockSize;
+        out.m_joinTables = m_joinTables;
+        out.m_sourcePreparations = true;
+
+        // The windows are computed the first time the stream is collected
+        auto computed = std::make_shared<std::once_flag>();
+        const Ctream<T> upstream = *this;
+        out.m_preparations.emplace_back([computed, result, upstream] ()
+        {
+            std::call_once(*computed, [&result, &upstream] ()
+            {
+                result->compute(upstream);
+            });
+        });
+        return out;
+    }
+
+    /** @} */
+
+    /**
+     * @name Output the streamed data
+     * @{
+     */
+
+    /**
+     * @brief Use a Collector to extract usable data from the stream
+     * 
+     * @tparam A Type of the collector's accumulator (see @ref{Collector} for
+     * more info)
+     * @tparam R Output type
+     * @param collector Collector
+     * @return R Output data
+     */
+    template<typename A, typename R = A>
+    R collect(const collectors::Collector<T, A, R>& collector) const
+    {
+        return collect(collector, nullptr);
+    }
+
+    /**
+     * @brief Use a Collector to extract usable data from the stream, and get
+     * statistics on the execution
+     * 
+     * @details
+     * Statistics are only recorded if `CTREAM_ENABLE_PROFILING` is defined
+     * (see @ref{profiling})
+     * 
+     * @tparam A Type of the collector's accumulator (see @ref{Collector} for
+     * more info)
+     * @tparam R Output type
+     * @param collector Collector
+     * @param stats Output statistics (ignored if nullptr)
+     * @return R Output data
+     */
+    template<typename A, typename R = A>
+    R collect(const collectors::Collector<T, A, R>& collector,
+              profiling::CollectStats* stats) const
+    {
+        return run(collector, stats, nullptr);
+    }
+
+    /**
+     * @brief Use a Collector to extract usable data from the stream, unless
+     * it is cancelled
+     * 
+     * @details
+     * The workers check the token between blocks of elements, so a cancelled
+     * collect stops shortly after the cancellation. Its partial results and
+     * the elements it created are then discarded.
+     * 
+     * @tparam A Type of the collector's accumulator (see @ref{Collector} for
+     * more info)
+     * @tparam R Output type
+     * @param collector Collector
+     * @param token Token that cancels the collect
+     * @param deadline Time after which the collect is cancelled
+     * @return R Output data
+     * @throws Cancelled if the collect was cancelled before all the elements
+     * were processed
+     */
+    template<typename A, typename R = A>
+    R collect(const collectors::Collector<T, A, R>& collector,
+              const CancellationToken& token,
+              std::chrono::steady_clock::time_point deadline
+                      = std::chrono::steady_clock::time_point::max()) const
+    {
+        const StopCondition stop{&token, deadline};
+        return run(collector, nullptr, &stop);
+    }
+
+    /**
+     * @brief Use a Collector to extract usable data from the stream, unless
+     * it takes too long
+     * 
+     * @details
+     * See the cancellation token overload of collect.
+     * 
+     * @tparam A Type of the collector's accumulator (see @ref{Collector} for
+     * more info)
+     * @tparam R Output type
+     * @param collector Collector
+     * @param deadline Time after which the collect is cancelled
+     * @return R Output data
+     * @throws Cancelled if the deadline was reached before all the elements
+     * were processed
+     */
+    template<typename A, typename R = A>
+    R collect(const collectors::Collector<T, A, R>& collector,
+              std::chrono::steady_clock::time_point deadline) const
+    {
+        const StopCondition stop{nullptr, deadline};
+        return run(collector, nullptr, &stop);
+    }
+
+    /**
+     * @brief Use several Collectors to extract usable data from the stream in
+     * a single pass
+     * 
+     * @details
+     * Each element is computed once and fed to all the collectors (see
+     * @ref{collectors::Tee}).
+     * 
+     * @param first First collector
+     * @param second Second collector
+     * @param others Other collectors
+     * @return std::tuple<...> Output of each collector
+     */
+    template<typename C1, typename C2, typename... Cs,
+             typename = typename std::enable_if<
+                     IsCollectorOf<C1, T>::value && IsCollectorOf<C2, T>::value>::type>
+    std::tuple<typename C1::ReturnType, typename C2::ReturnType, typename Cs::ReturnType...>
+    collect(const C1& first, const C2& second, const Cs&... others) const
+    {
+        return collect(collectors::Tee<T, C1, C2, Cs...>{first, second, others...});
+    }
+
+    /**
+     * @brief Get the sum of the elements in the stream
+     * 
+     * @details
+     * Only for elements that are default-constructible and implement addition
+     * For strings, use @ref{concat} instead for better performance
+     * 
+     * @return T Sum of the elements
+     */
+    T sum() const
+    {
+        return collect(collectors::Sum<T>{});
+    }
+
+    /**
+     * @brief Get the minimum of the elements in the stream
+     * 
+     * @return T Minimum of the elements
+     */
+    T min() const
+    {
+        return collect(collectors::Min<T>{});
+    }
+
+    /**
+     * @brief Get the maximum of the elements in the stream
+     * 
+     * @return T Maximum of the elements
+     */
+    T max() const
+    {
+        return collect(collectors::Max<T>{});
+    }
+
+    /**
+     * @brief Get the product of the elements in the stream
+     * 
+     * @details
+     * Only for elements that are constructible from `1` and implement product
+     * 
+     * @return T Product of the elements
+     */
+    T product() const
+    {
+        return collect(collectors::Product<T>{});
+    }
+
+    /**
+     * @brief Get a string that concatenates all elements in the stream
+     * 
+     * @details
+     * Only for elements that can be fed to an ostream
+     * 
+     * @return std::string Concatenated string
+     */
+    std::string concat() const
+    {
+        return collect(collectors::Concat<T>{});
+    }
+
+    /**
+     * @brief Get a list containing the elements in the stream
+     * 
+     * @return std::list<T> Output list
+     */
+    std::list<T> toList() const
+    {
+        return collect(collectors::ToList<T>{});
+    }
+
+    /**
+     * @brief Get a vector containing the elements in the stream
+     * 
+     * @return std::vector<T> Output vector
      */
+    std::vector<T> toVector() const
+    {
+        const size_t estimatedNThreads = threadsFor(m_containerSize, m_maxThreads);
+        size_t estimatedChunkSize = m_containerSize / estimatedNThreads;
+
+        // Deterministic collects supply an accumulator per block
+        if (m_blockSize)
+            estimatedChunkSize = std::min(estimatedChunkSize, m_blockSize);
+        return collect(collectors::ToVector<T>{estimatedChunkSize});
+    }
 
     /**
-     * @brief Remove from the stream the elements that do not match a filter
+     * @brief Call a function on each element of the stream, in parallel
      * 
-     * @param filter A condition on a stream element. The element remains in
-     * the stream if and only if it matches the filter
-     * @return Ctream<T> A stream with only the filtered data
+     * @details
+     * See @ref{collectors::ForEach}: the function is called concurrently from
+     * the collecting threads, in no particular order.
+     * 
+     * @param consumer Thread-safe function called on each element
      */
-    Ctream<T> filter(const std::function<bool(const T&)> filter) const
+    void forEach(const std::function<void(const T&)>& consumer) const
     {
-        PipelineStep newPipelineStep = [this, &filter] (const void* elt)
-        {
-            if (filter(*reinterpret_cast<const T*>(elt)))
-                return elt;
-            return (void const*)(0);
-        };
-        return Ctream<T>(m_arena, m_containerSize, m_sourceData, m_pipeline,
-                         newPipelineStep);
+        collect(collectors::ForEach<T>{consumer});
     }
 
     /**
-     * @brief Extract data from the elements of the stream.
+     * @brief Call a function on each element of the stream, in order
      * 
      * @details
-     * When the data can be extracted by reference from the elements, this is
-     * better than @ref{map} because is does not copy and construct new elements
+     * The threads evaluate blocks of consecutive positions, taken in order,
+     * into buffers. A thread passes the elements of its block to the function
+     * once the previous block was passed, then hands the turn over to the
+     * next block: the function is called by one thread at a time, and the
+     * threads only synchronize once per block.
      * 
-     * @tparam U The type of the extracted data
-     * @param extractor A function that, given an element of the stream,
-     * returns a const reference to type U data
-     * @return Ctream<U> A stream with the extracted data
+     * @param consumer Function called on each element
      */
-    template<typename U>
-    Ctream<U> extract(const std::function<const U&(const T&)>& extractor) const
+    void forEachOrdered(const std::function<void(const T&)>& consumer) const
     {
-        PipelineStep newPipelineStep = [this, &extractor] (const void* elt)
+        orderedBlocks([&consumer] (std::vector<T>& block, size_t)
         {
-            return &extractor(*reinterpret_cast<const T*>(elt));
-        };
-        return Ctream<U>(m_arena, m_containerSize, m_sourceData, m_pipeline,
-                         newPipelineStep);
+            for (const T& element : block)
+                consumer(element);
+        }, [] (std::vector<T>&, size_t) {});
     }
 
     /**
-     * @brief Transform the data from the elements in the stream.
+     * @brief Write the elements of the stream to an output iterator, in order
      * 
      * @details
-     * If the mapper you want to use can return a const reference, it is
-     * preferable to use @ref{extract} instead to avoid overhead
+     * Random-access iterators are written in parallel: each block of
+     * elements (see @ref{forEachOrdered}) is written by the thread that
+     * evaluated it, once the number of elements before it is known. Other
+     * iterators are written one block at a time.
      * 
-     * @tparam U The type of the transformed data
-     * @param mapper A function that, given an element of the stream,
-     * returns an element of type U
-     * @return Ctream<U> A stream with the transformed data
+     * @param out Destination, which must have room for all the elements
+     * @return OutputIt Iterator past the last written element
      */
-    template<typename U>
-    Ctream<U> map(const std::function<U(const T&)>& mapper) const
+    template<typename OutputIt>
+    OutputIt into(OutputIt out) const
     {
-        PipelineStep newPipelineStep = [this, &mapper] (const void* elt)
-        {
-            return m_arena->construct<U>(mapper(*reinterpret_cast<const T*>(elt)));
-        };
-        return Ctream<U>(m_arena, m_containerSize, m_sourceData, m_pipeline,
-                         newPipelineStep);
+        return writeInto(out, SIZE_MAX,
+                    typename std::iterator_traits<OutputIt>::iterator_category{});
     }
 
     /**
-     * @brief Cast the elements of the stream into a new type by construction.
+     * @brief Write the elements of the stream to an array, in order and in
+     * parallel
      * 
-     * @tparam U The type of the transformed data
-     * @return Ctream<U> A stream with the transformed data
+     * @details
+     * See @ref{into}.
+     * 
+     * @param data Destination array
+     * @param size Number of elements of the array
+     * @return size_t Number of written elements
+     * @throws std::out_of_range If the stream has more elements than the
+     * array (the elements of the first blocks may have been written)
      */
-    template<typename U>
-    Ctream<U> map() const
+    size_t into(T* data, size_t size) const
     {
-        PipelineStep newPipelineStep = [this] (const void* elt)
-        {
-            return m_arena->construct<U>(*reinterpret_cast<const T*>(elt));
-        };
-        return Ctream<U>(m_arena, m_containerSize, m_sourceData, m_pipeline,
-                         newPipelineStep);
+        return size_t(writeInto(data, size, std::random_access_iterator_tag{}) - data);
     }
 
-    /** @} */
+    /**
+     * @brief Get a uniform random sample of k elements of the stream
+     * 
+     * @details
+     * See @ref{collectors::Sample}: the sample only depends on the seed and
+     * on the number of threads.
+     * 
+     * @param k Number of elements in the sample
+     * @param seed Seed of the random draws
+     * @return std::vector<T> Sampled elements (all the elements if the stream
+     * has less than k elements), in random order
+     */
+    std::vector<T> sample(size_t k, std::uint64_t seed) const
+    {
+        return collect(collectors::Sample<T>{k, seed});
+    }
 
     /**
-     * @name Output the streamed data
-     * @{
+     * @brief Sort the elements of the stream, spilling sorted runs to disk
+     * when they exceed a memory budget
+     * 
+     * @details
+     * See @ref{collectors::ExternalSort}.
+     * 
+     * @param memoryBudget Memory budget of the buffered elements, in bytes
+     * @param less Comparison function
+     * @param directory Directory of the spill files (the system's temporary
+     * directory if it is empty)
+     * @return collectors::SortedRuns<T> Sorted elements, read with forEach()
      */
+    collectors::SortedRuns<T> externalSort(
+            size_t memoryBudget,
+            const std::function<bool(const T&, const T&)>& less = std::less<T>{},
+            const std::string& directory = "") const
+    {
+        return collect(collectors::ExternalSort<T>{memoryBudget, less, directory});
+    }
 
     /**
-     * @brief Use a Collector to extract usable data from the stream
+     * @brief Group the elements of the stream by key, spilling partitions to
+     * disk when they exceed a memory budget
      * 
-     * @tparam A Type of the collector's accumulator (see @ref{Collector} for
-     * more info)
-     * @tparam R Output type
-     * @param collector Collector
-     * @return R Output data
+     * @details
+     * See @ref{collectors::ExternalGroupBy}.
+     * 
+     * @tparam K Key type
+     * @param key Key function
+     * @param nPartitions Number of partitions, each of which must fit in memory
+     * @param memoryBudget Memory budget of the buffered elements, in bytes
+     * @param directory Directory of the spill files (the system's temporary
+     * directory if it is empty)
+     * @return collectors::SpilledGroups<T, K> Groups, read with forEach()
      */
-    template<typename A, typename R = A>
-    R collect(const collectors::Collector<T, A, R>& collector) const
+    template<typename K>
+    collectors::SpilledGroups<T, K> externalGroupBy(
+            const std::function<K(const T&)>& key,
+            size_t nPartitions,
+            size_t memoryBudget,
+            const std::string& directory = "") const
     {
-        constexpr size_t MULTITHREAD_MIN_SIZE =
-                internal::fine_tuning::MULTITHREAD_MIN_SIZE;
-        constexpr size_t THREADS_PER_CORE =
-                internal::fine_tuning::THREADS_PER_CORE;
+        return collect(collectors::ExternalGroupBy<T, K>{
+                key, nPartitions, memoryBudget, directory});
+    }
 
-        const size_t nThreads = std::min(
-            1 + (m_containerSize) / MULTITHREAD_MIN_SIZE,
-            size_t(THREADS_PER_CORE * std::thread::hardware_concurrency()));
+    /** @} */
+
+private:
+    // Allow other Ctream<...> classes to access private members
+    template<typename U>
+    friend class Ctream;
+    template<typename K, typename U>
+    friend class JoinTable;
+    template<typename U>
+    friend class ScanResult;
+    template<typename U>
+    friend class CacheResult;
+    template<typename U, typename C>
+    friend class WindowResult;
+    template<typename S, typename U>
+    friend class Pipeline;
+
+    /// An shared arena to store the data that has to be constructed
+    /// Shared with all previous and next Ctreams in the pipeline
+    std::shared_ptr<Arena> m_arena{ new Arena };
+
+    /// Arenas of the elements created by the pipeline during collects, also
+    /// shared with all previous and next Ctreams in the pipeline
+    std::shared_ptr<RunArenas> m_runArenas{ new RunArenas };
+
+    /// A functor that allows to access item i in the source, or nullptr if it
+    /// was filtered out
+    SourceDataRetriever m_sourceData{};
+
+    std::vector<PipelineStep> m_pipeline{};
+
+    /// Size of the source container. This is all the elements still in the
+    /// pipeline AND the elements that were filtered out. Calling m_sourceData
+    /// on i is valid if and only if i is within [0, m_containerSize - 1]
+    size_t m_containerSize{0};
+
+    /// Actions that must be done once before the elements can be computed
+    /// (e.g. building the hash tables of joins)
+    std::vector<std::function<void()>> m_preparations{};
+
+    /// Whether some preparations depend on the elements of the source (e.g.
+    /// scans), so that they are done again for a new source
+    bool m_sourcePreparations{false};
+
+    /// Join tables of the compiled pipeline whose source the stream comes
+    /// from (nullptr if it does not come from one)
+    std::shared_ptr<JoinTables> m_joinTables{};
+
+    /// Maximum number of threads used to process the stream (0 if not limited)
+    size_t m_maxThreads{0};
+
+    /// NUMA topology used to collect the stream (nullptr if not NUMA-aware)
+    std::shared_ptr<const numa::Topology> m_topology{};
+
+    /// Size of the blocks of deterministic collects (0 if not deterministic)
+    size_t m_blockSize{0};
+
+    /// Number of positions ahead of the current one whose source element is
+    /// prefetched by collects (0 to disable prefetching)
+    size_t m_prefetchDistance{0};
+
+    /// Address to prefetch for a source element (nullptr to prefetch the
+    /// element itself)
+    std::function<const void*(const void*)> m_prefetchAddress{};
+
+    /// Set by the first collect that moves elements out of the source owned
+    /// by the stream, so that the next collects of any stream created from
+    /// the source throw (nullptr if the source is not owned)
+    std::shared_ptr<std::atomic<bool>> m_sourceConsumed{};
+
+    /// Whether the elements reaching the end of the pipeline are not used by
+    /// anything else, and can be moved from (e.g. created by a map)
+    bool m_movableItems{false};
+
+    /// Whether the elements reaching the end of the pipeline are the elements
+    /// of the source
+    bool m_sourceItems{false};
+
+    /// Whether the collects of the stream move elements out of the source
+    bool m_movesSource{false};
+
+    /// Whether position i of the stream is position i of its source (compiled
+    /// pipelines can then be executed on a new source without being rebuilt)
+    bool m_sourceSized{true};
+
+    /// Only if source container does not handle random access
+    /// This vector stored in the arena contains a pointer to each element by 
+    /// index
+    std::vector<const T*>* m_elementsWithIndex{nullptr};
+
+    /// Index the elements of a list, which does not provide random access
+    void indexList(const std::list<T>& values)
+    {
+        m_elementsWithIndex = m_arena->construct<std::vector<const T*>>();
+        m_elementsWithIndex->reserve(values.size());
+        for (const auto& v : values)
+            m_elementsWithIndex->emplace_back(&v);
+
+        // The index lives in the arena, which is shared by the whole pipeline
+        const std::vector<const T*>* elements = m_elementsWithIndex;
+        m_sourceData = [elements] (size_t i) { return (*elements)[i]; };
+    }
+
+    /// Feed an element to an accumulator, moving it if nothing else uses it
+    template<typename A, typename R>
+    void accumulateItem(const collectors::Collector<T, A, R>& collector,
+                        A& a,
+                        const T* item) const
+    {
+        if (m_movableItems)
+            collector.accumulate(a, std::move(*const_cast<T*>(item)));
+        else
+            collector.accumulate(a, *item);
+    }
+
+    /// Collect the stream, unless the stop condition (if any) is met
+    template<typename A, typename R>
+    R run(const collectors::Collector<T, A, R>& collector,
+          profiling::CollectStats* stats,
+          const StopCondition* stop) const
+    {
+        // Workers also stop early when another one failed
+        const StopCondition noStop{nullptr, StopCondition::Clock::time_point::max()};
+        if (!stop)
+            stop = &noStop;
+
+        const size_t nThreads = threadsFor(m_containerSize, m_maxThreads);
+        consumeSource();
+
+        // The elements created by the pipeline only live during the collect
+        const RunArenas::Lease lease{*m_runArenas};
+        Arena& runArena = lease.arena();
+        Profiler profiler{stats, m_containerSize, nThreads, m_pipeline.size(),
+                          *m_arena, runArena};
+
+        prepare();
+        if (stop->check())
+            throw Cancelled{};
+
+        if (m_blockSize)
+            return collectBlocks(collector, runArena, *stop, profiler);
+
+        if (m_topology && nThreads > 1)
+            return collectNuma(collector, nThreads, runArena, *stop, profiler);
 
         if (nThreads < 2)
         {
             // If only 1 thread is used, do directly in current thread
             A a = collector.supply();
-            for (size_t i = 0; i < m_containerSize; ++i)
             {
-                // Compute the i'th item
-                const T* item = computeItem(i);
-                if (item)
-                    collector.accumulate(a, *item);
+                RunArenaScope scope{runArena};
+                ProfiledThread profiled{profiler, 0};
+                accumulateRange(collector, a, 0, m_containerSize, *stop);
             }
-            return collector.finish(a);
+            if (stop->stopped())
+                throw Cancelled{};
+
+            R result = collector.finish(a);
+            profiler.finish();
+            return result;
         }
         else
         {
             // Initialize empty containers
             std::vector<A> chunks;
-            std::vector<std::thread> threads;
             chunks.reserve(nThreads);
-            threads.reserve(nThreads);
+            for (size_t i = 0; i < nThreads; ++i)
+                chunks.emplace_back(supplyAt(collector, i));
 
             // Accumulate values in separate chunks
-            size_t first = 0;
-            for (size_t i = 0; i < nThreads; ++i)
+            parallelFor(m_containerSize, nThreads,
+                    [this, &chunks, &collector, &profiler, &runArena, stop]
+                    (size_t t, size_t first, size_t last)
+            {
+                RunArenaScope scope{runArena};
+                ProfiledThread profiled{profiler, t};
+                accumulateRange(collector, chunks[t], first, last, *stop);
+            });
+            if (stop->stopped())
+                throw Cancelled{};
+
+            // Combine all chunks
+            profiler.startCombine();
+            A a = collector.supply();
+            for (auto& chunk : chunks)
+                collector.combine(a, chunk);
+            profiler.stopCombine();
+
+            R result = collector.finish(a);
+            profiler.finish();
+            return result;
+        }
+    }
+
+    /// Accumulate the elements [first, last) of the stream, and stop early if
+    /// the stop condition is met
+    template<typename A, typename R>
+    void accumulateRange(const collectors::Collector<T, A, R>& collector,
+                         A& a,
+                         size_t first,
+                         size_t last,
+                         const StopCondition& stop) const
+    {
+        constexpr size_t INTERVAL = fine_tuning::CANCELLATION_CHECK_INTERVAL;
+        const size_t distance = m_prefetchDistance;
+        size_t j = first;
+        try
+        {
+            for (size_t block = first; block < last; block = j)
+            {
+                if (stop.check(block))
+                    return;
+                const size_t blockLast = block + std::min(INTERVAL, last - block);
+                for (j = block; j < blockLast; ++j)
+                {
+                    if (distance && distance < last - j)
+                        prefetchItem(j + distance);
+
+                    // Collect item (if not filtered out)
+                    const T* item = computeItem(j);
+                    if (item)
+                        accumulateItem(collector, a, item);
+                }
+            }
+        }
+        catch (...)
+        {
+            // The workers of the next elements can stop
+            stop.fail(j);
+            throw;
+        }
+    }
+
+    /// Collect the stream in blocks of m_blockSize positions, combined in a
+    /// fixed tree
+    template<typename A, typename R>
+    R collectBlocks(const collectors::Collector<T, A, R>& collector,
+                    Arena& runArena,
+                    const StopCondition& stop,
+                    Profiler& profiler) const
+    {
+        const size_t size = m_containerSize;
+        const size_t blockSize = m_blockSize;
+        const size_t nBlocks = std::max(size_t(1), (size + blockSize - 1) / blockSize);
+        const size_t nThreads = std::min(threadsFor(size, m_maxThreads), nBlocks);
+
+        std::vector<A> blocks;
+        blocks.reserve(nBlocks);
+        for (size_t b = 0; b < nBlocks; ++b)
+            blocks.emplace_back(supplyAt(collector, b));
+
+        parallelFor(nBlocks, nThreads,
+                [this, &blocks, &collector, &profiler, &runArena, &stop,
+                 size, blockSize] (size_t t, size_t first, size_t last)
+        {
+            RunArenaScope scope{runArena};
+            ProfiledThread profiled{profiler, t};
+            for (size_t b = first; b < last; ++b)
+            {
+                accumulateRange(collector, blocks[b], b * blockSize,
+                                std::min(size, (b + 1) * blockSize), stop);
+            }
+        });
+        if (stop.stopped())
+            throw Cancelled{};
+
+        // Pairwise combine: block b absorbs block b + width at each level
+        profiler.startCombine();
+        for (size_t width = 1; width < nBlocks; width *= 2)
+        {
+            for (size_t b = 0; b + width < nBlocks; b += 2 * width)
+                collector.combine(blocks[b], blocks[b + width]);
+        }
+        profiler.stopCombine();
+
+        R result = collector.finish(blocks[0]);
+        profiler.finish();
+        return result;
+    }
+
+    /// Evaluate the stream in blocks of consecutive positions, taken in order
+    /// by the threads: inTurn(block, offset) is called on the elements of each
+    /// block, one block at a time and in order, with the number of elements
+    /// of the blocks before it; then afterTurn(block, offset) is called while
+    /// the next blocks take their turn
+    template<typename F, typename G>
+    void orderedBlocks(const F& inTurn, const G& afterTurn) const
+    {
+        consumeSource();
+        prepare();
+        const size_t size = m_containerSize;
+        const size_t blockSize = fine_tuning::ORDERED_BLOCK_SIZE;
+        const size_t nBlocks = (size + blockSize - 1) / blockSize;
+        const size_t nThreads = std::min(threadsFor(size, m_maxThreads),
+                                         std::max(nBlocks, size_t(1)));
+
+        std::atomic<size_t> nextBlock{0};
+        std::mutex turnMx;
+        std::condition_variable turnCv;
+        size_t turn = 0;
+        size_t offset = 0;
+
+        // Exception of the first block that failed: the blocks before it still
+        // take their turn, and may fail first
+        size_t failedBlock = SIZE_MAX;
+        std::exception_ptr error;
+
+        auto work = [&] ()
+        {
+            const RunArenas::Lease lease{*m_runArenas};
+            Arena& scratch = lease.arena();
+            RunArenaScope scope{scratch};
+            std::vector<T> block;
+            size_t b = 0;
+            try
+            {
+                for (b = nextBlock++; b < nBlocks; b = nextBlock++)
+                {
+                    block.clear();
+                    const size_t last = std::min(size, (b + 1) * blockSize);
+                    for (size_t j = b * blockSize; j < last; ++j)
+                    {
+                        const T* item = computeItem(j);
+                        if (!item)
+                            continue;
+                        if (m_movableItems)
+                            block.emplace_back(std::move(*const_cast<T*>(item)));
+                        else
+                            block.emplace_back(*item);
+                    }
+                    scratch.reset();
+
+                    // Wait for the turn of the block, then hand it over
+                    size_t blockOffset;
+                    {
+                        std::unique_lock<std::mutex> lock{turnMx};
+                        turnCv.wait(lock, [&] () { return turn == b || b > failedBlock; });
+                        if (b > failedBlock)
+                            return;
+                        blockOffset = offset;
+                        inTurn(block, blockOffset);
+                        offset += block.size();
+                        turn = b + 1;
+                    }
+                    turnCv.notify_all();
+                    afterTurn(block, blockOffset);
+                }
+            }
+            catch (...)
+            {
+                // The threads waiting for the turn of the next blocks can stop
+                {
+                    std::lock_guard<std::mutex> lock{turnMx};
+                    if (b < failedBlock)
+                    {
+                        failedBlock = b;
+                        error = std::current_exception();
+                    }
+                }
+                turnCv.notify_all();
+            }
+        };
+
+        if (nThreads < 2)
+        {
+            work();
+        }
+        else
+        {
+            WorkerThreads threads{nThreads};
+            for (size_t t = 0; t < nThreads; ++t)
+                threads.spawn(t, work);
+            threads.join();
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /// Write the elements in order to a random-access iterator: the blocks
+    /// are written in parallel once their offset is known
+    template<typename OutputIt>
+    OutputIt writeInto(OutputIt out, size_t limit, std::random_access_iterator_tag) const
+    {
+        size_t written = 0;
+        orderedBlocks([limit, &written] (std::vector<T>& block, size_t offset)
+        {
+            if (block.size() > limit - offset)
+                throw std::out_of_range("The destination is too small for the stream");
+            written = offset + block.size();
+        }, [out] (std::vector<T>& block, size_t offset)
+        {
+            std::move(block.begin(), block.end(), out + offset);
+        });
+        return out + written;
+    }
+
+    /// Write the elements in order to an output iterator, one block at a time
+    template<typename OutputIt>
+    OutputIt writeInto(OutputIt out, size_t, std::input_iterator_tag) const
+    {
+        orderedBlocks([&out] (std::vector<T>& block, size_t)
+        {
+            out = std::move(block.begin(), block.end(), out);
+        }, [] (std::vector<T>&, size_t) {});
+        return out;
+    }
+
+    /// Output iterators have no category of their own to dispatch on
+    template<typename OutputIt>
+    OutputIt writeInto(OutputIt out, size_t limit, std::output_iterator_tag) const
+    {
+        return writeInto(out, limit, std::input_iterator_tag{});
+    }
+
+    /// Collect the stream with threads pinned to the nodes of m_topology
+    template<typename A, typename R>
+    R collectNuma(const collectors::Collector<T, A, R>& collector,
+                  size_t nThreads,
+                  Arena& runArena,
+                  const StopCondition& stop,
+                  Profiler& profiler) const
+    {
+        const numa::Topology& topology = *m_topology;
+        const size_t size = m_containerSize;
+
+        // Threads are spread evenly over the nodes, and each group of threads
+        // processes a contiguous range of the source
+        const size_t nGroups = std::min(topology.nodes.size(), nThreads);
+        std::vector<size_t> firstThreadOfGroup(nGroups + 1);
+        for (size_t g = 0; g <= nGroups; ++g)
+            firstThreadOfGroup[g] = g * nThreads / nGroups;
+        const auto firstIndexOfThread = [size, nThreads] (size_t t)
+        {
+            return size_t(double(t) * double(size) / double(nThreads));
+        };
+
+        // Each range goes to the node that holds its memory, if it is known
+        std::vector<int> nodeOfGroup(nGroups);
+        for (size_t g = 0; g < nGroups; ++g)
+            nodeOfGroup[g] = int(g);
+        if (topology.locator)
+        {
+            std::vector<int> owners(nGroups, -1);
+            std::vector<char> taken(topology.nodes.size(), 0);
+            bool known = true;
+            for (size_t g = 0; g < nGroups && known; ++g)
+            {
+                const size_t first = firstIndexOfThread(firstThreadOfGroup[g]);
+                const size_t last = firstIndexOfThread(firstThreadOfGroup[g + 1]);
+                const void* address = (first < last)
+                        ? m_sourceData(first + (last - first) / 2)
+                        : nullptr;
+                const int owner = address ? topology.locator(address) : -1;
+                known = owner >= 0 && size_t(owner) < taken.size() && !taken[owner];
+                if (known)
+                {
+                    taken[owner] = 1;
+                    owners[g] = owner;
+                }
+            }
+            if (known)
+                nodeOfGroup = owners;
+        }
+
+        // Each thread works on its node, so that its accumulator and arena
+        // pages are allocated there
+        std::vector<std::unique_ptr<A>> chunks(nThreads);
+        std::vector<std::unique_ptr<A>> groupChunks(nGroups);
+        const auto runOnNode = [&topology] (int node)
+        {
+            if (topology.pinThreads)
+                numa::pinCurrentThread(topology.nodes[node]);
+            numaNodeOfThread() = node;
+        };
+        {
+            WorkerThreads threads{nThreads};
+            for (size_t g = 0; g < nGroups; ++g)
+            {
+                for (size_t t = firstThreadOfGroup[g]; t < firstThreadOfGroup[g + 1]; ++t)
+                {
+                    const int node = nodeOfGroup[g];
+                    const size_t first = firstIndexOfThread(t);
+                    const size_t last = firstIndexOfThread(t + 1);
+                    threads.spawn(t,
+                            [this, &collector, &chunks, &profiler, &runOnNode,
+                             &runArena, &stop, node, t, first, last] ()
+                    {
+                        runOnNode(node);
+                        RunArenaScope scope{runArena};
+                        ProfiledThread profiled{profiler, t};
+                        chunks[t].reset(new A(supplyAt(collector, t)));
+                        accumulateRange(collector, *chunks[t], first, last, stop);
+                    });
+                }
+            }
+            threads.join();
+        }
+        if (stop.stopped())
+            throw Cancelled{};
+
+        // Combine the chunks of each node on the node, then across nodes
+        profiler.startCombine();
+        WorkerThreads threads{nGroups};
+        for (size_t g = 0; g < nGroups; ++g)
+        {
+            threads.spawn(g,
+                    [&collector, &chunks, &groupChunks, &firstThreadOfGroup,
+                     &nodeOfGroup, &runOnNode, g] ()
             {
-                chunks.emplace_back(collector.supply());
-                auto& chunk = chunks.back();
+                runOnNode(nodeOfGroup[g]);
+                groupChunks[g].reset(new A(collector.supply()));
+                for (size_t t = firstThreadOfGroup[g]; t < firstThreadOfGroup[g + 1]; ++t)
+                {
+                    collector.combine(*groupChunks[g], *chunks[t]);
+                    chunks[t].reset();
+                }
+            });
+        }
+        threads.join();
+
+        A a = collector.supply();
+        for (auto& groupChunk : groupChunks)
+            collector.combine(a, *groupChunk);
+        profiler.stopCombine();
+
+        R result = collector.finish(a);
+        profiler.finish();
+        return result;
+    }
+
+    /// Record that the stream is evaluated: streams that move the elements of
+    /// the source they own can only be evaluated once, and no stream of that
+    /// source can be evaluated after them
+    void consumeSource() const
+    {
+        if (!m_sourceConsumed)
+            return;
+        const bool consumed = m_movesSource
+                ? m_sourceConsumed->exchange(true)
+                : m_sourceConsumed->load();
+        if (consumed)
+            throw std::logic_error("ctream: the elements of the source were "
+                                   "moved by a previous collect");
+    }
+
+    /// Called on a stream whose step replaces the elements of the previous
+    /// step without moving them: its collects only move source elements if a
+    /// previous step did (but still need them not to be moved)
+    void replacesElements()
+    {
+        if (m_sourceItems)
+            m_movesSource = false;
+        m_sourceItems = false;
+    }
+
+    /// Run the preparations of the pipeline (only the first call does work)
+    void prepare() const
+    {
+        for (const auto& preparation : m_preparations)
+            preparation();
+    }
+
+    /// Create the stream resulting from a join with another stream
+    template<typename K, typename R, typename U>
+    Ctream<R> joined(const Ctream<U>& other,
+                     const std::function<K(const U&)>& rightKey,
+                     const std::shared_ptr<JoinTable<K, U>>& table,
+                     const PipelineStep& newPipelineStep) const
+    {
+        Ctream<R> out(*this, newPipelineStep);
+        out.m_movableItems = true;
+        out.replacesElements();
+        out.m_sourcePreparations = m_sourcePreparations || dependsOnSource(other);
+
+        // The table is built the first time the stream is collected
+        out.m_preparations.emplace_back([table, other, rightKey] ()
+        {
+            table->buildOnce(other, rightKey);
+        });
+        return out;
+    }
 
-                const size_t last = (i == nThreads - 1)
-                        ? (m_containerSize)
-                        : (first + m_containerSize / nThreads);
+    /// Whether a stream comes from the source of the compiled pipeline this
+    /// stream comes from
+    template<typename U>
+    bool dependsOnSource(const Ctream<U>& other) const
+    {
+        return m_joinTables && other.m_joinTables == m_joinTables;
+    }
 
-                threads.emplace_back(
-                        [this, first, last, &chunk, &collector] ()
-                {
-                    for (size_t j = first; j < last; ++j)
-                    {
-                        // Collect item (if not filtered out)
-                        const T* item = computeItem(j);
-                        if (item)
-                            collector.accumulate(chunk, *item);
-                    }
-                });
+    /// Table of a join with another stream: in compiled pipelines, the table
+    /// of the previous builds is kept if the other stream does not come from
+    /// the source of the pipeline
+    template<typename K, typename U>
+    std::shared_ptr<JoinTable<K, U>> joinTable(const Ctream<U>& other) const
+    {
+        if (!m_joinTables)
+            return std::make_shared<JoinTable<K, U>>();
+        return m_joinTables->next<JoinTable<K, U>>(!dependsOnSource(other));
+    }
 
-                // Next thread picks up where this thread left
-                first = last;
-            }
+    /// Create the stream resulting from a scan of this stream
+    Ctream<T> scanned(const T& init,
+                      const std::function<T(const T&, const T&)>& op,
+                      bool inclusive) const
+    {
+        auto result = std::make_shared<ScanResult<T>>();
+        Ctream<T> out(m_containerSize, [result] (size_t i)
+        {
+            return (void const*)(result->at(i));
+        });
+        out.m_arena = m_arena;
+        out.m_runArenas = m_runArenas;
+        out.m_maxThreads = m_maxThreads;
+        out.m_topology = m_topology;
+        out.m_blockSize = m_blockSize;
+        out.m_joinTables = m_joinTables;
+        out.m_sourcePreparations = true;
 
-            // Wait for all chunks to be ready
-            for (auto& thread : threads)
-                if (thread.joinable())
-                    thread.join();
+        // The scan is computed the first time the stream is collected
+        auto computed = std::make_shared<std::once_flag>();
+        const Ctream<T> upstream = *this;
+        out.m_preparations.emplace_back(
+                [computed, result, upstream, init, op, inclusive] ()
+        {
+            std::call_once(*computed, [&] ()
+            {
+                upstream.prepare();
+                result->compute(upstream, init, op, inclusive);
+            });
+        });
+        return out;
+    }
 
-            // Combine all chunks
-            A a = collector.supply();
-            for (auto& chunk : chunks)
-                collector.combine(a, chunk);
+    /// Prefetch the source element at position i
+    void prefetchItem(size_t i) const
+    {
+        const void* address = m_sourceData(i);
+        if (address && m_prefetchAddress)
+            address = m_prefetchAddress(address);
+        prefetchCacheLine(address);
+    }
 
-            return collector.finish(a);
+    /// Compute the element of the stream at position i (or nullptr if it is
+    /// filtered out)
+    const T* computeItem(size_t i) const
+    {
+#ifdef CTREAM_ENABLE_PROFILING
+        size_t* counters = Profiler::currentCounters();
+        if (counters)
+            return countedComputeItem(i, counters);
+#endif
+        // Sources can also filter elements out (e.g. scans)
+        void const* item = m_sourceData(i);
+        for (const auto& step : m_pipeline)
+        {
+            if (!item)
+                break;
+            item = step(item);
         }
+        return reinterpret_cast<const T*>(item);
     }
 
-    /**
-     * @brief Get the sum of the elements in the stream
-     * 
-     * @details
-     * Only for elements that are default-constructible and implement addition
-     * For strings, use @ref{concat} instead for better performance
-     * 
-     * @return T Sum of the elements
-     */
-    T sum() const
+#ifdef CTREAM_ENABLE_PROFILING
+    /// Same as computeItem, but count the elements entering each step
+    const T* countedComputeItem(size_t i, size_t* counters) const
     {
-        return collect(collectors::Sum<T>{});
+        void const* item = m_sourceData(i);
+        for (size_t k = 0; k < m_pipeline.size(); ++k)
+        {
+            if (!item)
+                return nullptr;
+            ++counters[k];
+            item = m_pipeline[k](item);
+        }
+        if (item)
+            ++counters[m_pipeline.size()];
+        return reinterpret_cast<const T*>(item);
     }
+#endif
+};
+
+/// Source of a compiled pipeline, that can be replaced between executions
+template<typename S>
+struct SourceBinding
+{
+    /// Elements of random access sources
+    const S* data{nullptr};
+
+    /// Pointers to the elements of sources without random access
+    std::vector<const S*> index{};
+
+    bool randomAccess{true};
+};
+
+/**
+ * @brief Pipeline built once, that can be executed on different sources
+ * 
+ * @details
+ * Binding a new source reuses the pipeline steps and the memory of the arenas
+ * of the previous collects instead of creating them again. Pipelines
+ * containing steps that are precomputed from the source (scans, windows,
+ * caches, samples, and joins with streams of the source) are rebuilt at each
+ * binding. The hash tables of the joins with other streams are only built
+ * once, at the first collect.
+ * 
+ * A pipeline must not be bound while a stream returned by a previous binding
+ * is being collected.
+ * 
+ * @tparam S Type of the source elements
+ * @tparam T Type of the output elements
+ */
+template<typename S, typename T>
+class Pipeline
+{
+public:
+    using Builder = std::function<Ctream<T>(const Ctream<S>&)>;
 
     /**
-     * @brief Get the minimum of the elements in the stream
+     * @brief Construct a pipeline
      * 
-     * @return T Minimum of the elements
+     * @param builder A function that creates the output stream from a stream
+     * of source elements
      */
-    T min() const
+    Pipeline(const Builder& builder)
+            : m_builder{builder}
+            , m_binding{std::make_shared<SourceBinding<S>>()}
+            , m_runArenas{std::make_shared<RunArenas>()}
+            , m_joinTables{std::make_shared<JoinTables>()}
+            , m_stream{build(0)}
     {
-        return collect(collectors::Min<T>{});
     }
 
     /**
-     * @brief Get the maximum of the elements in the stream
+     * @brief Execute the pipeline on a vector
      * 
-     * @return T Maximum of the elements
+     * @param values Vector containing the values to stream
+     * @return const Ctream<T>& The stream, valid until the next binding
      */
-    T max() const
+    const Ctream<T>& bind(const std::vector<S>& values)
     {
-        return collect(collectors::Max<T>{});
+        return bind(values.data(), values.size());
     }
 
     /**
-     * @brief Get the product of the elements in the stream
+     * @brief Execute the pipeline on a list
      * 
-     * @details
-     * Only for elements that are constructible from `1` and implement product
-     * 
-     * @return T Product of the elements
+     * @param values List containing the values to stream
+     * @return const Ctream<T>& The stream, valid until the next binding
      */
-    T product() const
+    const Ctream<T>& bind(const std::list<S>& values)
     {
-        return collect(collectors::Product<T>{});
+        // List does not provide random access so we have to index it (the
+        // memory of the previous index is reused)
+        m_binding->randomAccess = false;
+        m_binding->index.clear();
+        for (const auto& v : values)
+            m_binding->index.emplace_back(&v);
+        return rebind(values.size());
     }
 
     /**
-     * @brief Get a string that concatenates all elements in the stream
-     * 
-     * @details
-     * Only for elements that can be fed to an ostream
+     * @brief Execute the pipeline on a C array
      * 
-     * @return std::string Concatenated string
+     * @param values Array containing the values to stream
+     * @param size Number of elements in the array
+     * @return const Ctream<T>& The stream, valid until the next binding
      */
-    std::string concat() const
+    const Ctream<T>& bind(const S* values, size_t size)
     {
-        return collect(collectors::Concat<T>{});
+        m_binding->randomAccess = true;
+        m_binding->data = values;
+        return rebind(size);
     }
 
-    /**
-     * @brief Get a list containing the elements in the stream
-     * 
-     * @return std::list<T> Output list
-     */
-    std::list<T> toList() const
+private:
+    Builder m_builder;
+    std::shared_ptr<SourceBinding<S>> m_binding;
+    std::shared_ptr<RunArenas> m_runArenas;
+    std::shared_ptr<JoinTables> m_joinTables;
+    Ctream<T> m_stream;
+
+    /// Create the output stream, for a source of the given size
+    Ctream<T> build(size_t size) const
     {
-        return collect(collectors::ToList<T>{});
+        std::shared_ptr<SourceBinding<S>> binding = m_binding;
+        Ctream<S> source(size, [binding] (size_t i)
+        {
+            if (binding->randomAccess)
+                return (void const*)(&binding->data[i]);
+            return (void const*)(binding->index[i]);
+        });
+
+        // Builds share the run arenas and the join tables that do not depend
+        // on the source
+        source.m_runArenas = m_runArenas;
+        source.m_joinTables = m_joinTables;
+        m_joinTables->rewind();
+        return m_builder(source);
     }
 
-    /**
-     * @brief Get a vector containing the elements in the stream
-     * 
-     * @return std::vector<T> Output vector
-     */
-    std::vector<T> toVector() const
+    const Ctream<T>& rebind(size_t size)
     {
-        const size_t estimatedNThreads = internal::fine_tuning::THREADS_PER_CORE
-                * std::thread::hardware_concurrency();
-        const size_t estimatedChunkSize = m_containerSize / estimatedNThreads;
-        return collect(collectors::ToVector<T>{estimatedChunkSize});
+        if (!m_stream.m_sourcePreparations && m_stream.m_sourceSized)
+        {
+            // The run arenas of the previous executions are reused
+            m_stream.m_containerSize = size;
+        }
+        else
+        {
+            // Precomputed steps and positions depend on the previous source
+            m_stream = build(size);
+        }
+        return m_stream;
     }
+};
 
-    /** @} */
+/// Collector that gives its accumulator instead of finishing it
+template<typename C>
+class AccumulatorOf : public collectors::Collector<typename C::InputType,
+                                                   typename C::AccumulatorType,
+                                                   typename C::AccumulatorType>
+{
+public:
+    using T = typename C::InputType;
+    using A = typename C::AccumulatorType;
 
-private:
-    // Allow other Ctream<...> classes to access private members
-    template<typename U>
-    friend class Ctream;
+    /// The accumulators get the indices of the collect, after firstIndex
+    explicit AccumulatorOf(const C& collector, std::uint64_t firstIndex = 0)
+            : m_collector{collector}
+            , m_firstIndex{firstIndex}
+    {
+    }
 
-    /// An shared arena to store the data that has to be constructed
-    /// Shared with all previous and next Ctreams in the pipeline
-    std::shared_ptr<Arena> m_arena{ new Arena };
+    A supply() const override { return supplyAt(m_collector, m_firstIndex + supplyIndex()); }
+    void accumulate(A& a, const T& b) const override { m_collector.accumulate(a, b); }
+    void accumulate(A& a, T&& b) const override { m_collector.accumulate(a, std::move(b)); }
+    void combine(A& a, A& b) const override { m_collector.combine(a, b); }
+    A finish(A& a) const override { return std::move(a); }
 
-    /// A functor that allows to access item i in the source, or nullptr if it
-    /// was filtered out
-    SourceDataRetriever m_sourceData{};
+private:
+    const C& m_collector;
+    std::uint64_t m_firstIndex;
+};
 
-    std::vector<PipelineStep> m_pipeline{};
+/**
+ * @brief Collect of a pipeline over a vector that only grows, which only
+ * processes the elements appended since the previous collect
+ * 
+ * @details
+ * The combined accumulator of the elements processed so far is retained.
+ * Each refresh binds the pipeline to the new elements only, collects them
+ * into a new accumulator, and combines it into the retained one, so that its
+ * cost is proportional to the number of new elements. The result is the
+ * finish of a copy of the retained accumulator, which must therefore be
+ * copyable: that copy costs as much as the accumulator (e.g. all the
+ * elements for @ref{collectors::ToVector}), and is only made by the
+ * refreshes that found new elements. The other ones return the previous
+ * result.
+ * 
+ * The pipeline must process each element independently of the others
+ * (filters, maps, extracts and joins with streams that do not come from the
+ * vector, but not scans, windows or samples), and the elements that were
+ * processed must not be modified. The hash tables of the joins are built by
+ * the first refresh only, so the joined streams must not change either. A
+ * query must not be refreshed concurrently.
+ * 
+ * @tparam S Type of the source elements
+ * @tparam C Type of the collector
+ */
+template<typename S, typename C>
+class IncrementalQuery
+{
+public:
+    using T = typename C::InputType;
+    using A = typename C::AccumulatorType;
+    using R = typename C::ReturnType;
 
-    /// Size of the source container. This is all the elements still in the
-    /// pipeline AND the elements that were filtered out. Calling m_sourceData
-    /// on i is valid if and only if i is within [0, m_containerSize - 1]
-    size_t m_containerSize{0};
+    static_assert(std::is_copy_constructible<A>::value,
+                  "Incremental queries require copyable accumulators");
 
-    /// Only if source container does not handle random access
-    /// This vector stored in the arena contains a pointer to each element by 
-    /// index
-    std::vector<const T*>* m_elementsWithIndex{nullptr};
+    IncrementalQuery(const std::vector<S>& values,
+                     const typename Pipeline<S, T>::Builder& builder,
+                     const C& collector)
+            : m_values{values}
+            , m_pipeline{builder}
+            , m_collector{collector}
+            , m_state{collector.supply()}
+    {
+    }
 
-    /// Compute the element of the stream at position i (or nullptr if it is
-    /// filtered out)
-    const T* computeItem(size_t i) const
+    /**
+     * @brief Collect the elements appended to the vector since the last
+     * refresh, and get the result of the collect of all its elements
+     * 
+     * @details
+     * If the vector shrank, all its elements are collected again.
+     * 
+     * @return const R& Result of the collector, valid until the next refresh
+     */
+    const R& refresh()
     {
-        void const* item = m_sourceData(i);
-        for (const auto& step : m_pipeline)
+        const size_t size = m_values.size();
+        if (size < m_processed)
         {
-            item = step(item);
-            if (!item)
-                break;
+            m_state = m_collector.supply();
+            m_processed = 0;
+            m_result.reset();
         }
-        return reinterpret_cast<const T*>(item);
+        if (size > m_processed)
+        {
+            // Each collect gets its own accumulator indices
+            const std::uint64_t firstIndex = ++m_collects << 32;
+            A delta = m_pipeline.bind(m_values.data() + m_processed, size - m_processed)
+                    .collect(AccumulatorOf<C>{m_collector, firstIndex});
+            m_collector.combine(m_state, delta);
+            m_processed = size;
+            m_result.reset();
+        }
+        if (!m_result)
+        {
+            // Finishing may consume the accumulator, which is still needed
+            A state = m_state;
+            m_result.reset(new R(m_collector.finish(state)));
+        }
+        return *m_result;
     }
+
+    /// Number of elements of the vector processed by the previous refreshes
+    size_t processed() const { return m_processed; }
+
+private:
+    const std::vector<S>& m_values;
+    Pipeline<S, T> m_pipeline;
+    C m_collector;
+    A m_state;
+    size_t m_processed{0};
+    std::uint64_t m_collects{0};
+    std::unique_ptr<R> m_result{};
 };
 
+
 /** @} */ // end group ctream
 
 } // namespace internal
 
+/**
+ * @brief Pipeline for data manipulation
+ * @ingroup ctream
+ */
+template<typename T>
+using Ctream = internal::Ctream<T>;
+
+/**
+ * @brief Build a pipeline once, to execute it on different sources
+ * @ingroup ctream
+ * 
+ * @details
+ * Example:
+ * ```
+ * auto pipeline = ctream::compile<int, long>([] (const ctream::Ctream<int>& s) {
+ *     return s.map<long>([] (int i) { return i * i; });
+ * });
+ * auto sum1 = pipeline.bind(vector1).sum();
+ * auto sum2 = pipeline.bind(vector2).sum();
+ * ```
+ * 
+ * @tparam S Type of the source elements
+ * @tparam T Type of the output elements
+ * @param builder A function that creates the output stream from a stream of
+ * source elements
+ */
+template<typename S, typename T>
+internal::Pipeline<S, T> compile(
+        const typename internal::NonDeduced<std::function<
+                internal::Ctream<T>(const internal::Ctream<S>&)>>::type& builder)
+{
+    return internal::Pipeline<S, T>(builder);
+}
+
+/**
+ * @brief Collect a pipeline over a vector that only grows, incrementally
+ * @ingroup ctream
+ * 
+ * @details
+ * See @ref{internal::IncrementalQuery}. Example:
+ * ```
+ * auto query = ctream::incremental(values, [] (const ctream::Ctream<int>& s) {
+ *     return s.filter([] (const int& i) { return i > 0; });
+ * }, ctream::collectors::Sum<int>{});
+ * auto sum1 = query.refresh();
+ * values.push_back(42);
+ * auto sum2 = query.refresh(); // Only processes 42
+ * ```
+ * 
+ * @tparam S Type of the source elements
+ * @tparam C Type of the collector
+ * @param values Vector whose elements are collected, which must outlive the
+ * query
+ * @param builder A function that creates the collected stream from a stream
+ * of source elements
+ * @param collector Collector of the elements of the stream
+ */
+template<typename S, typename C>
+internal::IncrementalQuery<S, C> incremental(
+        const std::vector<S>& values,
+        const typename internal::NonDeduced<std::function<
+                internal::Ctream<typename C::InputType>(const internal::Ctream<S>&)>>::type& builder,
+        const C& collector)
+{
+    return internal::IncrementalQuery<S, C>(values, builder, collector);
+}
+
 /**
  * @brief Stream a vector
  * @ingroup ctream
@@ -954,6 +5475,23 @@ internal::Ctream<T> toCtream(const std::vector<T>& vec)
     return internal::Ctream<T>(vec);
 }
 
+/**
+ * @brief Stream a vector, taking ownership of its elements
+ * @ingroup ctream
+ * 
+ * @details
+ * The elements are moved (instead of copied) into the result of the first
+ * collect, so such a stream can only be collected once: the next collects
+ * throw std::logic_error.
+ * 
+ * @param values Vector containing the values to stream
+ */
+template<typename T>
+internal::Ctream<T> toCtream(std::vector<T>&& vec)
+{
+    return internal::Ctream<T>(std::move(vec));
+}
+
 /**
  * @brief Stream a list
  * @ingroup ctream
@@ -966,6 +5504,23 @@ internal::Ctream<T> toCtream(const std::list<T>& list)
     return internal::Ctream<T>(list);
 }
 
+/**
+ * @brief Stream a list, taking ownership of its elements
+ * @ingroup ctream
+ * 
+ * @details
+ * The elements are moved (instead of copied) into the result of the first
+ * collect, so such a stream can only be collected once: the next collects
+ * throw std::logic_error.
+ * 
+ * @param values List containing the values to stream
+ */
+template<typename T>
+internal::Ctream<T> toCtream(std::list<T>&& list)
+{
+    return internal::Ctream<T>(std::move(list));
+}
+
 /**
  * @brief Stream a C array
  * @ingroup ctream
@@ -979,4 +5534,88 @@ internal::Ctream<T> toCtream(const T* array, size_t size)
     return internal::Ctream<T>(array, size);
 }
 
+/**
+ * @brief Stream two vectors together, as pairs of references to their
+ * elements with the same index
+ * @ingroup ctream
+ * 
+ * @details
+ * No element is copied: the pairs refer to the elements of the vectors. The
+ * stream has as many elements as the shortest vector.
+ * 
+ * @param first Vector containing the first element of each pair
+ * @param second Vector containing the second element of each pair
+ */
+template<typename A, typename B>
+internal::Ctream<std::pair<const A&, const B&>> zip(const std::vector<A>& first,
+                                                    const std::vector<B>& second)
+{
+    using Pair = std::pair<const A&, const B&>;
+    const size_t size = std::min(first.size(), second.size());
+    return internal::Ctream<Pair>(size, [&first, &second] (size_t i)
+    {
+        // The pair only has to live until the next element is computed by
+        // the same thread
+        Pair* slot = internal::scratchSlot<Pair>();
+        if (!slot)
+            return (void const*)(internal::runArena()->construct<Pair>(first[i], second[i]));
+        return (void const*)(new (slot) Pair(first[i], second[i]));
+    });
+}
+
+/**
+ * @brief Stream several vectors one after the other, as a single stream
+ * @ingroup ctream
+ * 
+ * @param shards Vectors containing the values to stream
+ */
+template<typename T>
+internal::Ctream<T> concat(const std::vector<const std::vector<T>*>& shards)
+{
+    // offsets[s] is the index in the stream of the first element of shard s
+    auto offsets = std::make_shared<std::vector<size_t>>();
+    offsets->reserve(shards.size() + 1);
+    offsets->emplace_back(0);
+    for (const auto* shard : shards)
+        offsets->emplace_back(offsets->back() + shard->size());
+
+    const size_t size = offsets->back();
+    return internal::Ctream<T>(size, [shards, offsets] (size_t i)
+    {
+        // Find the last shard that starts at or before i
+        const auto it = std::upper_bound(offsets->begin(), offsets->end(), i);
+        const size_t s = size_t(it - offsets->begin()) - 1;
+        return (void const*)(&(*shards[s])[i - (*offsets)[s]]);
+    });
+}
+
+/**
+ * @brief Stream several vectors one after the other, as a single stream
+ * @ingroup ctream
+ * 
+ * @param shards Vectors containing the values to stream
+ */
+template<typename T>
+internal::Ctream<T> concat(const std::vector<std::vector<T>>& shards)
+{
+    std::vector<const std::vector<T>*> pointers;
+    pointers.reserve(shards.size());
+    for (const auto& shard : shards)
+        pointers.emplace_back(&shard);
+    return concat(pointers);
+}
+
+/**
+ * @brief Stream several vectors one after the other, as a single stream
+ * @ingroup ctream
+ * 
+ * @param first First vector containing values to stream
+ * @param others Other vectors containing values to stream
+ */
+template<typename T, typename... Vectors>
+internal::Ctream<T> concat(const std::vector<T>& first, const Vectors&... others)
+{
+    return concat(std::vector<const std::vector<T>*>{&first, &others...});
+}
+
 } // namespace ctream
\ No newline at end of file
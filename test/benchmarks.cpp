@@ -1,35 +1,557 @@
-#include <catch2/catch_test_macros.hpp>
-#include <catch2/benchmark/catch_benchmark.hpp>
+// Benchmarks of Ctream pipelines against equivalent hand-written loops
+//
+// Every case is run for each source type (vector, list), each input size
+// (powers of 10 up to --max-size) and each maximum number of threads (powers
+// of 2 up to --threads). The hand-written loop baseline of each case is run
+// once per source type and size.
+//
+// With --tune-prefetch, the sum of --max-size values is measured instead for
+// each given prefetch distance and each source type (vector, list,
+// shuffled-list whose nodes are scattered in memory, and pointers to
+// scattered values), and the fastest distance of each source type is
+// reported.
+//
+// Usage:
+//   benchmark_ctream [--max-size N] [--threads N] [--min-time MS]
+//                    [--sources vector,list] [--filter TEXT]
+//                    [--format csv|json] [--tune-prefetch 0,4,16,...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "ctream.hpp"
 
-TEST_CASE("Benchmarks") {
+namespace
+{
+
+struct Options
+{
+    size_t maxSize{1000000};
+    size_t maxThreads{std::max(1u, 2 * std::thread::hardware_concurrency())};
+    double minTimeMs{100};
+    std::vector<std::string> sources{"vector", "list"};
+    std::string filter{};
+    std::string format{"csv"};
+    std::vector<size_t> prefetchDistances{};
+};
+
+struct Result
+{
+    std::string benchmark;
+    std::string source;
+    std::string variant;
+    size_t size;
+    size_t threads;
+    size_t iterations;
+    double nsPerIteration;
+};
+
+/// A benchmarked pipeline, and the equivalent hand-written loop
+struct Case
+{
+    std::string name;
+    std::function<void(size_t threads)> ctream;
+    std::function<void()> loop;
+};
+
+using Value = unsigned long;
+
+struct Person
+{
+    std::string firstName{"John"};
+    std::string lastName{"Doe"};
+    long age{56};
+};
+
+/// Prevent the compiler from optimizing the computation of a value away
+template<typename T>
+void keep(const T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+/// Run fn repeatedly for at least minTimeMs and return the mean time of a run
+double measure(const std::function<void()>& fn, double minTimeMs, size_t& iterations)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Warm up caches and the allocator
+    fn();
+
+    iterations = 0;
+    size_t batch = 1;
+    double elapsedNs = 0;
+    while (elapsedNs < minTimeMs * 1e6)
+    {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < batch; ++i)
+            fn();
+        elapsedNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        iterations += batch;
+        batch *= 2;
+    }
+    return elapsedNs / double(iterations);
+}
+
+double cheapCost(Value v) { return double(v * v); }
+
+double mediumCost(Value v)
+{
+    double x = double(v);
+    for (int k = 0; k < 8; ++k)
+        x = std::sqrt(x + 1.5) * 1.01;
+    return x;
+}
+
+double expensiveCost(Value v) { return double(std::to_string(v * 7919).size()); }
+
+/// Cases that stream a container of values (vector or list)
+template<typename Container>
+std::vector<Case> valueCases(const Container& values)
+{
+    std::vector<Case> cases;
+    const Container* data = &values;
 
-    struct Person
+    // Built-in collectors
+    cases.push_back(Case{"collect.sum",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).sum()); },
+        [data] () { Value s = 0; for (auto v : *data) s += v; keep(s); }});
+    cases.push_back(Case{"collect.product",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).product()); },
+        [data] () { Value p = 1; for (auto v : *data) p *= v; keep(p); }});
+    cases.push_back(Case{"collect.min",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).min()); },
+        [data] () {
+            Value m = data->empty() ? 0 : *data->begin();
+            for (auto v : *data) m = std::min(m, v);
+            keep(m);
+        }});
+    cases.push_back(Case{"collect.max",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).max()); },
+        [data] () {
+            Value m = data->empty() ? 0 : *data->begin();
+            for (auto v : *data) m = std::max(m, v);
+            keep(m);
+        }});
+    cases.push_back(Case{"collect.concat",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).concat()); },
+        [data] () {
+            std::stringstream ss;
+            for (auto v : *data) ss << v;
+            keep(ss.str());
+        }});
+    cases.push_back(Case{"collect.toList",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).toList()); },
+        [data] () { std::list<Value> l; for (auto v : *data) l.emplace_back(v); keep(l); }});
+    cases.push_back(Case{"collect.toVector",
+        [data] (size_t t) { keep(ctream::toCtream(*data).parallelism(t).toVector()); },
+        [data] () {
+            std::vector<Value> out;
+            out.reserve(data->size());
+            for (auto v : *data) out.emplace_back(v);
+            keep(out);
+        }});
+
+    cases.push_back(Case{"collect.accurateSum.deterministic",
+        [data] (size_t t) {
+            keep(ctream::toCtream(*data).parallelism(t).deterministic()
+                    .template map<double>([] (const Value& v) { return double(v) / 7; })
+                    .collect(ctream::collectors::AccurateSum<double>{}));
+        },
+        [data] () { double s = 0; for (auto v : *data) s += double(v) / 7; keep(s); }});
+    cases.push_back(Case{"collect.histogram",
+        [data] (size_t t) {
+            keep(ctream::toCtream(*data).parallelism(t)
+                    .collect(ctream::collectors::Histogram<Value>::uniform(0, 1000, 100)));
+        },
+        [data] () {
+            std::vector<size_t> bins(100, 0);
+            for (auto v : *data) if (v < 1000) ++bins[v / 10];
+            keep(bins);
+        }});
+    cases.push_back(Case{"collect.countBy",
+        [data] (size_t t) {
+            keep(ctream::toCtream(*data).parallelism(t)
+                    .collect(ctream::collectors::CountBy<Value>{}));
+        },
+        [data] () {
+            std::unordered_map<Value, size_t> counts;
+            for (auto v : *data) ++counts[v];
+            keep(counts);
+        }});
+    cases.push_back(Case{"sink.into",
+        [data] (size_t t) {
+            std::vector<Value> out(data->size());
+            ctream::toCtream(*data).parallelism(t).into(out.begin());
+            keep(out);
+        },
+        [data] () {
+            std::vector<Value> out(data->size());
+            std::copy(data->begin(), data->end(), out.begin());
+            keep(out);
+        }});
+    cases.push_back(Case{"cache.map.sumAndMax",
+        [data] (size_t t) {
+            auto cached = ctream::toCtream(*data).parallelism(t)
+                    .template map<double>([] (const Value& v) { return std::sqrt(double(v)); })
+                    .cache();
+            keep(cached.sum());
+            keep(cached.max());
+        },
+        [data] () {
+            double s = 0;
+            double m = 0;
+            for (auto v : *data)
+            {
+                const double r = std::sqrt(double(v));
+                s += r;
+                m = std::max(m, r);
+            }
+            keep(s);
+            keep(m);
+        }});
+
+    // Filter selectivities (values are uniform in [0, 1000))
+    for (Value percent : {1, 10, 50, 90, 100})
     {
-        std::string firstName{"John"};
-        std::string lastName{"Doe"};
-        long age{56};
-    };
-    
-    for (size_t sz = 1; sz < 1e5; sz *= 10)
+        const Value threshold = percent * 10;
+        cases.push_back(Case{"filter." + std::to_string(percent) + "pct.sum",
+            [data, threshold] (size_t t) {
+                keep(ctream::toCtream(*data).parallelism(t)
+                        .filter([threshold] (const Value& v) { return v < threshold; })
+                        .sum());
+            },
+            [data, threshold] () {
+                Value s = 0;
+                for (auto v : *data) if (v < threshold) s += v;
+                keep(s);
+            }});
+    }
+
+    // Map costs
+    struct Cost { const char* name; double (*fn)(Value); };
+    for (const Cost& cost : {Cost{"cheap", cheapCost},
+                             Cost{"medium", mediumCost},
+                             Cost{"expensive", expensiveCost}})
     {
-        std::vector<Person> vals{sz, Person{}};
+        auto fn = cost.fn;
+        cases.push_back(Case{std::string("map.") + cost.name + ".sum",
+            [data, fn] (size_t t) {
+                keep(ctream::toCtream(*data).parallelism(t)
+                        .template map<double>([fn] (const Value& v) { return fn(v); })
+                        .sum());
+            },
+            [data, fn] () {
+                double s = 0;
+                for (auto v : *data) s += fn(v);
+                keep(s);
+            }});
+    }
 
-        BENCHMARK("Streamed full name " + std::to_string(sz)) {
-            ctream::toCtream<Person>(vals)
-                    .map<std::string>([] (const auto& p) {
+    return cases;
+}
+
+/// Cases that stream a container of persons (vector or list)
+template<typename Container>
+std::vector<Case> personCases(const Container& persons)
+{
+    std::vector<Case> cases;
+    const Container* data = &persons;
+
+    cases.push_back(Case{"fullName.toVector",
+        [data] (size_t t) {
+            keep(ctream::toCtream(*data).parallelism(t)
+                    .template map<std::string>([] (const Person& p) {
                         return p.firstName + " " + p.lastName;
                     })
-                    .toVector();
-        };
-        BENCHMARK("For-loop full name " + std::to_string(sz)) {
+                    .toVector());
+        },
+        [data] () {
             std::vector<std::string> names;
-            names.reserve(sz);
-            for (const auto& v : vals)
-                names.emplace_back(v.firstName + " " + v.lastName);
-        };
+            names.reserve(data->size());
+            for (const auto& p : *data)
+                names.emplace_back(p.firstName + " " + p.lastName);
+            keep(names);
+        }});
+
+    return cases;
+}
+
+/// Thread counts to benchmark: powers of 2 up to maxThreads, and maxThreads
+std::vector<size_t> threadCounts(size_t maxThreads)
+{
+    std::vector<size_t> counts;
+    for (size_t t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+void run(const Options& options,
+         const std::string& source,
+         size_t size,
+         const std::vector<Case>& cases,
+         std::vector<Result>& results)
+{
+    for (const auto& c : cases)
+    {
+        if (c.name.find(options.filter) == std::string::npos)
+            continue;
+
+        size_t iterations = 0;
+        double ns = measure(c.loop, options.minTimeMs, iterations);
+        results.push_back(Result{c.name, source, "loop", size, 1, iterations, ns});
+        std::cerr << c.name << " " << source << " " << size << " loop\n";
+
+        for (size_t t : threadCounts(options.maxThreads))
+        {
+            const auto& fn = c.ctream;
+            ns = measure([&fn, t] () { fn(t); }, options.minTimeMs, iterations);
+            results.push_back(Result{c.name, source, "ctream", size, t, iterations, ns});
+            std::cerr << c.name << " " << source << " " << size << " ctream "
+                      << t << " threads\n";
+        }
+    }
+}
+
+template<typename Container>
+void runSource(const Options& options,
+               const std::string& source,
+               std::vector<Result>& results)
+{
+    for (size_t size = 1; size <= options.maxSize; size *= 10)
+    {
+        Container values;
+        for (size_t i = 0; i < size; ++i)
+            values.push_back(Value(i * 7919 % 1000));
+        run(options, source, size, valueCases(values), results);
+    }
+}
+
+template<typename Container>
+void runPersons(const Options& options,
+                const std::string& source,
+                std::vector<Result>& results)
+{
+    for (size_t size = 1; size <= options.maxSize; size *= 10)
+    {
+        Container persons(size, Person{});
+        run(options, source, size, personCases(persons), results);
+    }
+}
+
+/// Sum the values of a stream with each prefetch distance, and report the
+/// fastest one
+void tunePrefetch(const Options& options,
+                  const std::string& source,
+                  size_t size,
+                  const std::function<Value(size_t threads, size_t distance)>& sum,
+                  std::vector<Result>& results)
+{
+    size_t best = 0;
+    double bestNs = 0;
+    for (size_t distance : options.prefetchDistances)
+    {
+        size_t iterations = 0;
+        const size_t t = options.maxThreads;
+        const double ns = measure([&sum, t, distance] () { keep(sum(t, distance)); },
+                                  options.minTimeMs, iterations);
+        results.push_back(Result{"prefetch.sum", source,
+                                 "distance=" + std::to_string(distance),
+                                 size, t, iterations, ns});
+        if (bestNs == 0 || ns < bestNs)
+        {
+            best = distance;
+            bestNs = ns;
+        }
+    }
+    std::cerr << "Best prefetch distance for " << source << ": " << best << "\n";
+}
+
+void runPrefetchTuning(const Options& options, std::vector<Result>& results)
+{
+    const size_t size = options.maxSize;
+    std::vector<Value> values;
+    for (size_t i = 0; i < size; ++i)
+        values.push_back(Value(i * 7919 % 1000));
+
+    // Positions of the values in scattered memory
+    std::vector<size_t> order(size);
+    for (size_t i = 0; i < size; ++i)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64{42});
+
+    for (const auto& source : options.sources)
+    {
+        if (source == "vector")
+        {
+            tunePrefetch(options, source, size, [&values] (size_t t, size_t d) {
+                return ctream::toCtream(values).parallelism(t).prefetch(d).sum();
+            }, results);
+        }
+        else if (source == "list" || source == "shuffled-list")
+        {
+            // Nodes are spliced in the shuffled order to scatter them
+            std::list<Value> list(values.begin(), values.end());
+            if (source == "shuffled-list")
+            {
+                std::vector<std::list<Value>::iterator> nodes;
+                for (auto it = list.begin(); it != list.end(); ++it)
+                    nodes.push_back(it);
+                std::list<Value> scattered;
+                for (size_t i : order)
+                    scattered.splice(scattered.end(), list, nodes[i]);
+                list.swap(scattered);
+            }
+            tunePrefetch(options, source, size, [&list] (size_t t, size_t d) {
+                return ctream::toCtream(list).parallelism(t).prefetch(d).sum();
+            }, results);
+        }
+        else if (source == "pointers")
+        {
+            std::vector<Value> storage(size);
+            std::vector<const Value*> pointers(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                storage[order[i]] = values[i];
+                pointers[i] = &storage[order[i]];
+            }
+            tunePrefetch(options, source, size, [&pointers] (size_t t, size_t d) {
+                return ctream::toCtream(pointers).parallelism(t)
+                        .prefetch(d, [] (const Value* const& p) -> const void* { return p; })
+                        .template extract<Value>([] (const Value* const& p) -> const Value& {
+                            return *p;
+                        })
+                        .sum();
+            }, results);
+        }
+    }
+}
+
+void print(const Options& options, const std::vector<Result>& results)
+{
+    if (options.format == "json")
+    {
+        std::cout << "[\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto& r = results[i];
+            std::cout << "  {\"benchmark\": \"" << r.benchmark << "\""
+                      << ", \"source\": \"" << r.source << "\""
+                      << ", \"variant\": \"" << r.variant << "\""
+                      << ", \"size\": " << r.size
+                      << ", \"threads\": " << r.threads
+                      << ", \"iterations\": " << r.iterations
+                      << ", \"ns_per_iteration\": " << r.nsPerIteration
+                      << ", \"ns_per_element\": " << r.nsPerIteration / double(r.size)
+                      << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        std::cout << "]\n";
     }
+    else
+    {
+        std::cout << "benchmark,source,variant,size,threads,iterations,"
+                     "ns_per_iteration,ns_per_element\n";
+        for (const auto& r : results)
+        {
+            std::cout << r.benchmark << "," << r.source << "," << r.variant
+                      << "," << r.size << "," << r.threads << "," << r.iterations
+                      << "," << r.nsPerIteration
+                      << "," << r.nsPerIteration / double(r.size) << "\n";
+        }
+    }
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss{list};
+    std::string item;
+    while (std::getline(ss, item, ','))
+        items.push_back(item);
+    return items;
+}
+
+bool parse(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string arg = argv[i];
+        const std::string value = argv[i + 1];
+        if (arg == "--max-size")
+            options.maxSize = size_t(std::stod(value));
+        else if (arg == "--threads")
+            options.maxThreads = std::max(size_t(1), size_t(std::stoul(value)));
+        else if (arg == "--min-time")
+            options.minTimeMs = std::stod(value);
+        else if (arg == "--sources")
+            options.sources = split(value);
+        else if (arg == "--filter")
+            options.filter = value;
+        else if (arg == "--format")
+            options.format = value;
+        else if (arg == "--tune-prefetch")
+        {
+            options.prefetchDistances.clear();
+            for (const auto& distance : split(value))
+                options.prefetchDistances.push_back(size_t(std::stoul(distance)));
+        }
+        else
+            return false;
+    }
+    return argc % 2 == 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--max-size N] [--threads N]"
+                  << " [--min-time MS] [--sources vector,list]"
+                  << " [--filter TEXT] [--format csv|json]"
+                  << " [--tune-prefetch 0,4,16,...]\n";
+        return 1;
+    }
+
+    std::vector<Result> results;
+    if (!options.prefetchDistances.empty())
+    {
+        runPrefetchTuning(options, results);
+        print(options, results);
+        return 0;
+    }
+    for (const auto& source : options.sources)
+    {
+        if (source == "vector")
+        {
+            runSource<std::vector<Value>>(options, source, results);
+            runPersons<std::vector<Person>>(options, source, results);
+        }
+        else if (source == "list")
+        {
+            runSource<std::list<Value>>(options, source, results);
+            runPersons<std::list<Person>>(options, source, results);
+        }
+    }
+
+    print(options, results);
 }
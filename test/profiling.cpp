@@ -0,0 +1,59 @@
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+#include "ctream.hpp"
+
+TEST_CASE("Profiling.Stats") {
+    const long n = 100000;
+    std::vector<long> ints;
+    for (long i = 0; i < n; ++i)
+        ints.emplace_back(i);
+
+    ctream::profiling::CollectStats stats;
+    auto sum = ctream::toCtream(ints)
+            .filter([] (long i) { return i % 4 == 0; })
+            .map<std::string>([] (long i) { return std::to_string(i); })
+            .map<long>([] (const std::string& s) { return long(s.size()); })
+            .collect(ctream::collectors::Sum<long>{}, &stats);
+
+    CHECK( sum > 0 );
+    CHECK( stats.containerSize == size_t(n) );
+    CHECK( stats.threadTimes.size() == stats.threads );
+    CHECK( stats.stageInputs == std::vector<size_t>{n, n / 4, n / 4, n / 4} );
+    CHECK( stats.selectivity(0) == 0.25 );
+    CHECK( stats.selectivity(1) == 1 );
+    CHECK( stats.imbalance() >= 1 );
+    CHECK( stats.arenaBytes >= (n / 4) * sizeof(std::string) );
+}
+
+TEST_CASE("Profiling.ScratchMap") {
+    std::vector<long> ints;
+    for (long i = 0; i < 100000; ++i)
+        ints.emplace_back(i);
+
+    // Small trivially copyable results do not use the arena
+    ctream::profiling::CollectStats stats;
+    auto sum = ctream::toCtream(ints)
+            .map<long>([] (long i) { return i * i; })
+            .map<double>([] (long i) { return double(i) / 2; })
+            .collect(ctream::collectors::Sum<double>{}, &stats);
+
+    CHECK( sum > 0 );
+    CHECK( stats.arenaBytes == 0 );
+}
+
+TEST_CASE("Profiling.Callback") {
+    std::vector<int> ints{1, 2, 3};
+
+    std::vector<size_t> sizes;
+    ctream::profiling::setCallback([&sizes] (const ctream::profiling::CollectStats& s) {
+        sizes.emplace_back(s.containerSize);
+    });
+    ctream::toCtream(ints).sum();
+    ctream::toCtream(ints).filter([] (int i) { return i > 1; }).max();
+    ctream::profiling::setCallback(nullptr);
+    ctream::toCtream(ints).sum();
+
+    CHECK( sizes == std::vector<size_t>{3, 3} );
+}
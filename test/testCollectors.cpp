@@ -1,5 +1,7 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/benchmark/catch_benchmark.hpp>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -80,3 +82,173 @@ TEST_CASE("Collectors.Max") {
             .collect(ctream::collectors::Max<long>{});
     CHECK( max == expectedMax );
 }
+
+TEST_CASE("Collectors.Histogram") {
+    std::vector<double> latencies;
+    for (long i = 0; i < 100000; ++i)
+        latencies.emplace_back(double((i * 7919) % 1200) / 10);
+
+    std::vector<size_t> expected(10, 0);
+    for (auto v : latencies)
+        if (v < 100)
+            ++expected[size_t(v / 10)];
+
+    auto uniform = ctream::toCtream(latencies)
+            .collect(ctream::collectors::Histogram<double>::uniform(0, 100, 10));
+    CHECK( uniform == expected );
+
+    std::vector<double> edges;
+    for (int e = 0; e <= 100; e += 10)
+        edges.emplace_back(e);
+    auto custom = ctream::toCtream(latencies)
+            .collect(ctream::collectors::Histogram<double>{edges});
+    CHECK( custom == expected );
+}
+
+TEST_CASE("Collectors.CountBy") {
+    std::vector<std::string> words;
+    for (long i = 0; i < 100000; ++i)
+        words.emplace_back(std::to_string(i % 7));
+
+    auto counts = ctream::toCtream(words)
+            .collect(ctream::collectors::CountBy<std::string>{});
+    REQUIRE( counts.size() == 7 );
+    CHECK( counts["0"] == 14286 );
+    CHECK( counts["6"] == 14285 );
+}
+
+TEST_CASE("Collectors.PartitionInto") {
+    std::vector<long> ints;
+    for (long i = 0; i < 100000; ++i)
+        ints.emplace_back(i);
+
+    auto shards = ctream::toCtream(ints)
+            .collect(ctream::collectors::PartitionInto<long>{
+                    4, [] (const long& v) { return size_t(v); }});
+    REQUIRE( shards.size() == 4 );
+    for (size_t s = 0; s < 4; ++s)
+    {
+        std::vector<long> expected;
+        for (long v = long(s); v < 100000; v += 4)
+            expected.emplace_back(v);
+        CHECK( shards[s] == expected );
+    }
+
+    // Scatter into sinks
+    std::vector<long> sums(3, 0);
+    std::vector<ctream::collectors::PartitionInto<long>::Sink> sinks;
+    for (size_t s = 0; s < 3; ++s)
+        sinks.emplace_back([&sums, s] (std::vector<long>& batch) {
+            for (auto v : batch)
+                sums[s] += v;
+        });
+    auto rest = ctream::toCtream(ints)
+            .collect(ctream::collectors::PartitionInto<long>{sinks});
+    CHECK( rest[0].empty() );
+    CHECK( sums[0] + sums[1] + sums[2] == 99999L * 100000 / 2 );
+}
+
+TEST_CASE("Collectors.Tee") {
+    std::vector<long> ints;
+    for (long i = 1; i <= 100000; ++i)
+        ints.emplace_back((i * 7919) % 100003);
+
+    std::atomic<long> calls{0};
+    auto stream = ctream::toCtream(ints).map<long>([&calls] (long i) {
+        ++calls;
+        return i;
+    });
+    auto results = stream.collect(ctream::collectors::Sum<long>{},
+                                  ctream::collectors::Min<long>{},
+                                  ctream::collectors::Max<long>{},
+                                  ctream::collectors::ToVector<long>{});
+
+    CHECK( calls == 100000 );
+    CHECK( std::get<0>(results) == ctream::toCtream(ints).sum() );
+    CHECK( std::get<1>(results) == ctream::toCtream(ints).min() );
+    CHECK( std::get<2>(results) == ctream::toCtream(ints).max() );
+    CHECK( std::get<3>(results) == ints );
+}
+
+TEST_CASE("Collectors.AccurateSum") {
+    // Naive summation loses the small values next to the large ones
+    std::vector<double> values;
+    for (long i = 0; i < 30000; ++i)
+    {
+        values.emplace_back(1e16);
+        values.emplace_back(1.0 + double(i % 7) / 8);
+        values.emplace_back(-1e16);
+    }
+    double expected = 0;
+    for (long i = 0; i < 30000; ++i)
+        expected += 1.0 + double(i % 7) / 8;
+
+    auto sum = ctream::toCtream(values).deterministic()
+            .collect(ctream::collectors::AccurateSum<double>{});
+    CHECK( sum == expected );
+
+    // Deterministic collects do not depend on the number of threads
+    std::vector<double> noisy;
+    for (long i = 1; i <= 100000; ++i)
+        noisy.emplace_back(1.0 / double(i) * ((i % 3) ? 1 : -3.7));
+    const double reference = ctream::toCtream(noisy).parallelism(1).deterministic().sum();
+    for (size_t threads : {2, 3, 8})
+        CHECK( ctream::toCtream(noisy).parallelism(threads).deterministic().sum() == reference );
+
+    // Teed collectors combine the blocks in the same tree
+    auto teed = ctream::toCtream(noisy).parallelism(3).deterministic(1000)
+            .collect(ctream::collectors::Sum<double>{}, ctream::collectors::ToVector<double>{});
+    CHECK( std::get<0>(teed) == ctream::toCtream(noisy).parallelism(1).deterministic(1000).sum() );
+    CHECK( std::get<1>(teed) == noisy );
+    CHECK( ctream::toCtream(noisy).parallelism(3).deterministic(1000).toVector() == noisy );
+}
+
+TEST_CASE("Collectors.ExternalSort") {
+    std::vector<long> ints;
+    for (long i = 0; i < 200000; ++i)
+        ints.emplace_back((i * 7919) % 100003);
+    std::vector<long> expected = ints;
+    std::sort(expected.begin(), expected.end());
+
+    // A budget of 64 kB spills the 1.6 MB of elements in several runs
+    for (size_t threads : {1, 4})
+    {
+        auto sorted = ctream::toCtream(ints).parallelism(threads).externalSort(1 << 16);
+        CHECK( sorted.spilledRuns() > 1 );
+        CHECK( sorted.size() == ints.size() );
+        std::vector<long> out;
+        sorted.forEach([&out] (const long& i) { out.emplace_back(i); });
+        CHECK( out == expected );
+    }
+
+    auto descending = ctream::toCtream(ints).externalSort(
+            1 << 30, [] (const long& a, const long& b) { return a > b; });
+    CHECK( descending.spilledRuns() == 0 );
+    std::vector<long> out;
+    descending.forEach([&out] (const long& i) { out.emplace_back(i); });
+    CHECK( out == std::vector<long>(expected.rbegin(), expected.rend()) );
+}
+
+TEST_CASE("Collectors.ExternalGroupBy") {
+    std::vector<long> ints;
+    for (long i = 0; i < 200000; ++i)
+        ints.emplace_back(i);
+
+    auto groups = ctream::toCtream(ints).parallelism(4)
+            .externalGroupBy<long>([] (const long& i) { return i % 1000; }, 8, 1 << 16);
+    CHECK( groups.spilledRuns() > 0 );
+    CHECK( groups.size() == ints.size() );
+
+    size_t nGroups = 0;
+    bool valid = true;
+    groups.forEach([&] (const long& key, std::vector<long>& group)
+    {
+        ++nGroups;
+        std::sort(group.begin(), group.end());
+        valid = valid && group.size() == 200;
+        for (size_t j = 0; j < group.size(); ++j)
+            valid = valid && group[j] == key + long(j) * 1000;
+    });
+    CHECK( nGroups == 1000 );
+    CHECK( valid );
+}
@@ -1,5 +1,11 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/benchmark/catch_benchmark.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -43,3 +49,718 @@ TEST_CASE("Base.toList.Large") {
 
     CHECK( sumOfSquares == expected );
 }
+
+TEST_CASE("Base.NestedCollects") {
+    std::vector<long> ints;
+    for (long i = 1; i <= 1000; ++i)
+        ints.emplace_back(i);
+    std::vector<long> small{1, 2, 3};
+
+    // The steps of a collect run by a step create elements of the same type,
+    // which must not overwrite the element the outer step reads
+    for (size_t threads : {1, 4})
+    {
+        auto nested = ctream::toCtream(ints).parallelism(threads)
+                .map<long>([] (const long& i) { return i * 10; })
+                .map<long>([&small] (const long& i) {
+                    const long inner = ctream::toCtream(small)
+                            .map<long>([] (const long& j) { return j * 1000; })
+                            .sum();
+                    return i + inner;
+                })
+                .toVector();
+        REQUIRE( nested.size() == ints.size() );
+        CHECK( nested.front() == 6010 );
+        CHECK( nested.back() == 16000 );
+
+        auto zipped = ctream::zip(ints, ints).parallelism(threads)
+                .map<long>([&small] (const std::pair<const long&, const long&>& p) {
+                    const long inner = ctream::zip(small, small)
+                            .map<long>([] (const std::pair<const long&, const long&>& q) {
+                                return q.first * q.second;
+                            })
+                            .sum();
+                    return p.first + p.second + inner - 14;
+                })
+                .sum();
+        CHECK( zipped == 1001000 );
+    }
+}
+
+TEST_CASE("Join.Inner") {
+    struct User {
+        long id;
+        std::string name;
+    };
+    struct Event {
+        long userId;
+        int value;
+    };
+
+    std::vector<User> users;
+    for (long i = 0; i < 2000; ++i)
+        users.push_back(User{i, "user" + std::to_string(i)});
+
+    // Events for users 0, 1, 2... and for unknown users 5000, 5001...
+    std::vector<Event> events;
+    for (long i = 0; i < 10000; ++i)
+        events.push_back(Event{(i % 3 == 0) ? 5000 + i : i % 2000, 1});
+
+    auto joined = ctream::toCtream(events)
+            .lookupJoin<long, std::string>(ctream::toCtream(users),
+                    [] (const Event& e) { return e.userId; },
+                    [] (const User& u) { return u.id; },
+                    [] (const Event&, const User& u) { return u.name; })
+            .toVector();
+
+    std::vector<std::string> expected;
+    for (const auto& e : events)
+        if (e.userId < 2000)
+            expected.push_back("user" + std::to_string(e.userId));
+
+    CHECK( joined == expected );
+}
+
+TEST_CASE("Join.LeftOuter") {
+    std::vector<int> keys{1, 2, 3, 4};
+    std::vector<int> values{2, 4, 6};
+
+    auto joined = ctream::toCtream(keys)
+            .leftLookupJoin<int, int>(ctream::toCtream(values).filter([] (int v) { return v != 6; }),
+                    [] (int k) { return k; },
+                    [] (int v) { return v; },
+                    [] (int k, const int* v) { return v ? k * 10 + *v : -k; })
+            .toVector();
+
+    CHECK( joined == std::vector<int>{-1, 22, -3, 44} );
+
+    // Keys of the looked up stream must be unique
+    std::vector<int> duplicates{2, 4, 4};
+    auto invalid = ctream::toCtream(keys)
+            .leftLookupJoin<int, int>(ctream::toCtream(duplicates),
+                    [] (int k) { return k; },
+                    [] (int v) { return v; },
+                    [] (int k, const int* v) { return v ? k * 10 + *v : -k; });
+    CHECK_THROWS_AS( invalid.toVector(), std::invalid_argument );
+}
+
+TEST_CASE("Sources.Zip") {
+    const long n = 10000;
+    std::vector<long> timestamps;
+    std::vector<double> values;
+    for (long i = 0; i < n; ++i)
+    {
+        timestamps.emplace_back(i);
+        values.emplace_back(0.5 * i);
+    }
+    values.emplace_back(-1); // Longer than timestamps: ignored
+
+    auto weighted = ctream::zip(timestamps, values)
+            .map<double>([] (const std::pair<const long&, const double&>& p) {
+                return p.first * p.second;
+            })
+            .toVector();
+
+    std::vector<double> expected;
+    for (long i = 0; i < n; ++i)
+        expected.emplace_back(0.5 * i * i);
+
+    CHECK( weighted == expected );
+}
+
+TEST_CASE("Sources.Concat") {
+    std::vector<long> shard1{1, 2, 3};
+    std::vector<long> shard2{};
+    std::vector<long> shard3;
+    for (long i = 4; i <= 10000; ++i)
+        shard3.emplace_back(i);
+
+    CHECK( ctream::concat(shard1, shard2, shard3).sum() == 10000 * 10001 / 2 );
+
+    std::vector<std::vector<long>> shards{shard1, shard2, shard3, shard1};
+    auto all = ctream::concat(shards).toVector();
+    REQUIRE( all.size() == 10003 );
+    CHECK( all.front() == 1 );
+    CHECK( all[9999] == 10000 );
+    CHECK( all.back() == 3 );
+}
+
+TEST_CASE("Scan.Inclusive") {
+    const long n = 10000;
+    std::vector<long> ints;
+    for (long i = 1; i <= n; ++i)
+        ints.emplace_back(i);
+
+    auto add = [] (const long& a, const long& b) { return a + b; };
+
+    // Running sums of the odd numbers, with filtered elements in between
+    auto sums = ctream::toCtream(ints)
+            .filter([] (long i) { return i % 2 == 1; })
+            .scan(100, add)
+            .toVector();
+
+    std::vector<long> expected;
+    long sum = 100;
+    for (long i = 1; i <= n; i += 2)
+        expected.emplace_back(sum += i);
+
+    CHECK( sums == expected );
+
+    // Filtered elements stay filtered after the scan
+    auto doubled = ctream::toCtream(ints)
+            .filter([] (long i) { return i % 2 == 1; })
+            .scan(100, add)
+            .map<long>([] (long s) { return 2 * s; })
+            .sum();
+    long expectedDoubled = 0;
+    for (auto s : expected)
+        expectedDoubled += 2 * s;
+    CHECK( doubled == expectedDoubled );
+
+    // Scanned streams can be manipulated further
+    auto evenSumsCount = ctream::toCtream(ints)
+            .scan(0, add)
+            .filter([] (long s) { return s % 2 == 0; })
+            .map<long>([] (long) { return 1; })
+            .sum();
+    CHECK( evenSumsCount == n / 2 );
+}
+
+TEST_CASE("Scan.Exclusive") {
+    // Offsets of variable-length records
+    std::vector<size_t> lengths;
+    for (size_t i = 0; i < 5000; ++i)
+        lengths.emplace_back(i % 7);
+
+    auto offsets = ctream::toCtream(lengths)
+            .exclusiveScan(0, [] (const size_t& a, const size_t& b) { return a + b; })
+            .toVector();
+
+    std::vector<size_t> expected;
+    size_t offset = 0;
+    for (auto length : lengths)
+    {
+        expected.emplace_back(offset);
+        offset += length;
+    }
+
+    CHECK( offsets == expected );
+}
+
+TEST_CASE("Window.TumblingAndSliding") {
+    std::vector<long> samples;
+    for (long i = 0; i < 10000; ++i)
+        samples.emplace_back((i * 7919) % 101);
+
+    // Sums of 1000-sample tumbling windows
+    auto sums = ctream::toCtream(samples)
+            .window(1000, 1000, ctream::collectors::Sum<long>{})
+            .toVector();
+
+    REQUIRE( sums.size() == 10 );
+    for (size_t w = 0; w < sums.size(); ++w)
+    {
+        long expected = 0;
+        for (size_t j = w * 1000; j < (w + 1) * 1000; ++j)
+            expected += samples[j];
+        CHECK( sums[w] == expected );
+    }
+
+    // Moving maximum over a sliding window of 64, of the even samples
+    auto maxima = ctream::toCtream(samples)
+            .filter([] (const long& v) { return v % 2 == 0; })
+            .window(64, 3, ctream::collectors::Max<long>{})
+            .toVector();
+
+    std::vector<long> evens;
+    for (auto v : samples)
+        if (v % 2 == 0)
+            evens.emplace_back(v);
+
+    REQUIRE( maxima.size() == (evens.size() - 64) / 3 + 1 );
+    for (size_t w = 0; w < maxima.size(); ++w)
+        CHECK( maxima[w] == *std::max_element(evens.begin() + w * 3,
+                                              evens.begin() + w * 3 + 64) );
+
+    // Not enough elements for a single window
+    CHECK( ctream::toCtream(samples)
+            .window(20000, 1, ctream::collectors::Sum<long>{})
+            .toVector().empty() );
+}
+
+TEST_CASE("Cache.Reuse") {
+    std::vector<long> ints;
+    for (long i = 0; i < 100000; ++i)
+        ints.emplace_back(i);
+
+    // The mapper runs once per element, whatever the number of collects
+    std::atomic<long> calls{0};
+    auto cached = ctream::toCtream(ints)
+            .map<long>([&calls] (const long& i) { ++calls; return i * 3; })
+            .cache();
+    CHECK( cached.sum() == 3 * (100000L * 99999 / 2) );
+    CHECK( cached.max() == 299997 );
+    CHECK( cached.filter([] (const long& v) { return v % 2 == 0; })
+                 .toVector().size() == 50000 );
+    CHECK( calls == 100000 );
+
+    // Filtered positions are skipped by the streams created from the cache
+    auto strings = ctream::toCtream(ints)
+            .filter([] (const long& i) { return i % 7 == 0; })
+            .map<std::string>([] (const long& i) { return std::to_string(i); })
+            .cache();
+    std::vector<std::string> expected;
+    for (long i = 0; i < 100000; i += 7)
+        expected.emplace_back(std::to_string(i));
+    CHECK( strings.toVector() == expected );
+    CHECK( strings.map<size_t>([] (const std::string& s) { return s.size(); })
+                  .sum() == ctream::toCtream(expected)
+                  .map<size_t>([] (const std::string& s) { return s.size(); }).sum() );
+}
+
+TEST_CASE("Sampling.Reservoir") {
+    std::vector<long> values;
+    for (long i = 0; i < 100000; ++i)
+        values.emplace_back(i);
+    auto stream = ctream::toCtream(values).parallelism(4);
+
+    auto sample = stream.sample(100, 42);
+    REQUIRE( sample.size() == 100 );
+    CHECK( stream.sample(100, 42) == sample );
+    CHECK( stream.sample(100, 43) != sample );
+
+    // Distinct elements of the stream, spread over the whole stream
+    std::sort(sample.begin(), sample.end());
+    CHECK( std::adjacent_find(sample.begin(), sample.end()) == sample.end() );
+    long sum = 0;
+    for (auto v : sample)
+        sum += v;
+    CHECK( sum / 100 > 30000 );
+    CHECK( sum / 100 < 70000 );
+
+    // Less elements than the sample size
+    CHECK( ctream::toCtream(values).filter([] (const long& v) { return v < 10; })
+            .sample(100, 42).size() == 10 );
+
+    // Collectors give the same sample each time they are used
+    ctream::collectors::Sample<long> collector{5, 42};
+    auto first = stream.collect(collector);
+    CHECK( stream.collect(collector) == first );
+    CHECK( stream.deterministic().collect(collector) == stream.deterministic().collect(collector) );
+
+    // Including NUMA-aware collects, where the threads supply their
+    // accumulators concurrently
+    auto numa = stream.numaAware(ctream::numa::Topology::simulated(2, 2));
+    auto numaSample = numa.collect(collector);
+    for (int attempt = 0; attempt < 10; ++attempt)
+        CHECK( numa.collect(collector) == numaSample );
+}
+
+TEST_CASE("Sampling.Bernoulli") {
+    std::vector<long> values;
+    for (long i = 0; i < 100000; ++i)
+        values.emplace_back(i);
+
+    auto sampled = ctream::toCtream(values).bernoulli(0.01, 7).toVector();
+    CHECK( sampled == ctream::toCtream(values).parallelism(1).bernoulli(0.01, 7).toVector() );
+    CHECK( sampled.size() > 800 );
+    CHECK( sampled.size() < 1200 );
+    CHECK( std::is_sorted(sampled.begin(), sampled.end()) );
+    CHECK( std::adjacent_find(sampled.begin(), sampled.end()) == sampled.end() );
+
+    CHECK( ctream::toCtream(values).bernoulli(1, 7).toVector() == values );
+    CHECK( ctream::toCtream(values).bernoulli(0, 7).toVector().empty() );
+}
+
+TEST_CASE("Collect.Cancellation") {
+    std::vector<long> ints;
+    for (long i = 0; i < 1000000; ++i)
+        ints.emplace_back(i);
+    auto stream = ctream::toCtream(ints);
+    const ctream::collectors::Sum<long> sum;
+
+    // Not cancelled
+    ctream::CancellationToken token;
+    CHECK( stream.collect(sum, token) == 999999L * 1000000 / 2 );
+    CHECK( stream.collect(sum, std::chrono::steady_clock::now() + std::chrono::hours(1))
+            == 999999L * 1000000 / 2 );
+
+    // Cancelled while the elements are processed
+    std::atomic<size_t> processed{0};
+    auto cancelling = stream.map<std::string>([&token, &processed] (long i) {
+        if (++processed == 1000)
+            token.cancel();
+        return std::to_string(i);
+    });
+    CHECK_THROWS_AS( cancelling.collect(ctream::collectors::Concat<std::string>{}, token),
+                     ctream::Cancelled );
+    CHECK( processed < ints.size() );
+
+    // Deadline already reached
+    CHECK_THROWS_AS( stream.collect(sum, std::chrono::steady_clock::now()),
+                     ctream::Cancelled );
+}
+
+namespace
+{
+// Counts the instances alive, to check that none is leaked
+struct Tracked
+{
+    static std::atomic<long>& alive() { static std::atomic<long> n{0}; return n; }
+    long value;
+    Tracked(long v) : value{v} { ++alive(); }
+    Tracked(const Tracked& o) : value{o.value} { ++alive(); }
+    ~Tracked() { --alive(); }
+};
+}
+
+TEST_CASE("Collect.Exceptions") {
+    std::vector<long> ints;
+    for (long i = 0; i < 1000000; ++i)
+        ints.emplace_back(i);
+
+    for (size_t threads : {1, 8})
+    {
+        // The exception of the first failing element is rethrown
+        auto failing = ctream::toCtream(ints).parallelism(threads)
+                .map<Tracked>([] (long i) {
+                    if (i % 100000 == 99999)
+                        throw std::runtime_error(std::to_string(i));
+                    return Tracked{i};
+                });
+        std::string message;
+        try
+        {
+            failing.collect(ctream::collectors::Custom<Tracked, long, long>{
+                    [] () { return 0L; },
+                    [] (long& a, const Tracked& t) { a += t.value; },
+                    [] (long& a, const long& b) { a += b; },
+                    [] (const long& a) { return a; }});
+        }
+        catch (const std::runtime_error& e)
+        {
+            message = e.what();
+        }
+        CHECK( message == "99999" );
+        CHECK( Tracked::alive() == 0 );
+    }
+}
+
+TEST_CASE("Sinks.ForEachAndInto") {
+    std::vector<long> ints;
+    for (long i = 0; i < 100000; ++i)
+        ints.emplace_back(i);
+    std::vector<long> odds;
+    for (long i = 1; i < 100000; i += 2)
+        odds.emplace_back(i);
+
+    for (size_t threads : {1, 8})
+    {
+        auto stream = ctream::toCtream(ints).parallelism(threads)
+                .filter([] (const long& i) { return i % 2 == 1; });
+
+        std::atomic<long> sum{0};
+        stream.forEach([&sum] (const long& i) { sum += i; });
+        CHECK( sum == 2500000000L );
+
+        std::vector<long> ordered;
+        stream.forEachOrdered([&ordered] (const long& i) { ordered.emplace_back(i); });
+        CHECK( ordered == odds );
+
+        // Output iterators are written in order, random-access ones in parallel
+        std::list<long> list;
+        stream.into(std::back_inserter(list));
+        CHECK( std::vector<long>(list.begin(), list.end()) == odds );
+
+        std::vector<long> buffer(odds.size() + 10, -1);
+        CHECK( stream.into(buffer.begin()) == buffer.begin() + long(odds.size()) );
+        CHECK( std::vector<long>(buffer.begin(), buffer.begin() + long(odds.size())) == odds );
+        CHECK( buffer.back() == -1 );
+
+        CHECK( stream.into(buffer.data(), buffer.size()) == odds.size() );
+        CHECK_THROWS_AS( stream.into(buffer.data(), odds.size() - 1), std::out_of_range );
+    }
+
+    // Exceptions of the consumer are rethrown
+    CHECK_THROWS_AS( ctream::toCtream(ints).parallelism(8).forEachOrdered([] (const long& i)
+    {
+        if (i == 50000)
+            throw std::runtime_error("consumer");
+    }), std::runtime_error );
+
+    // The exception of the first failing block is rethrown
+    for (int attempt = 0; attempt < 10; ++attempt)
+    {
+        std::string message;
+        try
+        {
+            ctream::toCtream(ints).parallelism(8)
+                    .map<long>([] (long i) {
+                        if (i % 10000 == 9999)
+                            throw std::runtime_error(std::to_string(i));
+                        return i;
+                    })
+                    .forEachOrdered([] (const long&) {});
+        }
+        catch (const std::runtime_error& e)
+        {
+            message = e.what();
+        }
+        CHECK( message == "9999" );
+    }
+}
+
+TEST_CASE("Prefetch.Sources") {
+    std::list<long> list;
+    std::vector<long> storage;
+    for (long i = 0; i < 10000; ++i)
+    {
+        list.emplace_back(i);
+        storage.emplace_back(i);
+    }
+    std::vector<const long*> pointers;
+    for (const auto& v : storage)
+        pointers.emplace_back(&v);
+
+    // Prefetching does not change the results, whatever the distance
+    for (size_t distance : {0, 1, 64, 100000})
+    {
+        CHECK( ctream::toCtream(list).prefetch(distance).sum() == 49995000L );
+        CHECK( ctream::toCtream(pointers).parallelism(4)
+                .prefetch(distance, [] (const long* const& p) -> const void* { return p; })
+                .extract<long>([] (const long* const& p) -> const long& { return *p; })
+                .filter([] (const long& v) { return v % 2 == 0; })
+                .sum() == 24995000L );
+    }
+
+    // Prefetch addresses are computed from the source elements
+    CHECK_THROWS_AS( ctream::toCtream(pointers)
+            .filter([] (const long* const& p) { return p != nullptr; })
+            .prefetch(8, [] (const long* const& p) -> const void* { return p; }),
+            std::logic_error );
+}
+
+TEST_CASE("Pipeline.Rebind") {
+    auto pipeline = ctream::compile<int, long>([] (const ctream::Ctream<int>& s) {
+        return s.filter([] (int i) { return i % 2 == 0; })
+                .map<long>([] (int i) { return long(i) * i; });
+    });
+
+    for (int n = 1; n <= 10000; n *= 10)
+    {
+        std::vector<int> ints;
+        for (int i = 1; i <= n; ++i)
+            ints.emplace_back(i);
+
+        long expected = 0;
+        for (int i = 2; i <= n; i += 2)
+            expected += long(i) * i;
+
+        CHECK( pipeline.bind(ints).sum() == expected );
+        CHECK( pipeline.bind(ints.data(), ints.size()).sum() == expected );
+        CHECK( pipeline.bind(std::list<int>(ints.begin(), ints.end())).sum() == expected );
+    }
+
+    // Elements that are stored in the run arenas, reused by each collect
+    auto names = ctream::compile<int, std::string>([] (const ctream::Ctream<int>& s) {
+        return s.map<std::string>([] (int i) { return std::string(40, char('a' + i % 26)); });
+    });
+    for (int n = 1; n <= 10000; n *= 10)
+    {
+        std::vector<int> ints(n, 1);
+        CHECK( names.bind(ints).concat() == std::string(40 * n, 'b') );
+        CHECK( names.bind(ints).concat() == std::string(40 * n, 'b') );
+    }
+
+    // Precomputed steps are recomputed for each source
+    auto running = ctream::compile<int, int>([] (const ctream::Ctream<int>& s) {
+        return s.scan(0, [] (const int& a, const int& b) { return a + b; });
+    });
+    CHECK( running.bind(std::vector<int>{1, 2, 3}).toVector() == std::vector<int>{1, 3, 6} );
+    CHECK( running.bind(std::vector<int>{4, 5}).toVector() == std::vector<int>{4, 9} );
+
+    // The hash tables of joins with other streams are only built once
+    std::vector<int> squares;
+    for (int i = 0; i < 100; ++i)
+        squares.emplace_back(i * i);
+    auto lookup = ctream::toCtream(squares);
+    std::atomic<int> keyCalls{0};
+    auto joined = ctream::compile<int, int>([&lookup, &keyCalls] (const ctream::Ctream<int>& s) {
+        return s.scan(0, [] (const int& a, const int& b) { return a + b; })
+                .lookupJoin<int, int>(lookup,
+                        [] (const int& i) { return i * i; },
+                        [&keyCalls] (const int& v) { ++keyCalls; return v; },
+                        [] (const int& i, const int& v) { return i + v; });
+    });
+    CHECK( joined.bind(std::vector<int>{1, 2, 200}).toVector() == std::vector<int>{2, 12} );
+    CHECK( joined.bind(std::vector<int>{4}).toVector() == std::vector<int>{20} );
+    CHECK( keyCalls == 100 );
+
+    // Joins with streams of the source are built for each source
+    auto self = ctream::compile<int, int>([] (const ctream::Ctream<int>& s) {
+        return s.lookupJoin<int, int>(s.filter([] (const int& i) { return i % 2 == 0; }),
+                [] (const int& i) { return i / 2; },
+                [] (const int& i) { return i; },
+                [] (const int& i, const int& v) { return i * 100 + v; });
+    });
+    CHECK( self.bind(std::vector<int>{2, 4, 8}).toVector() == std::vector<int>{402, 804} );
+    CHECK( self.bind(std::vector<int>{6, 12}).toVector() == std::vector<int>{1206} );
+}
+
+TEST_CASE("Pipeline.Incremental") {
+    std::vector<int> ints;
+    for (int i = 0; i < 10000; ++i)
+        ints.emplace_back(i);
+
+    // Only the appended elements go through the pipeline
+    std::atomic<long> calls{0};
+    auto sum = ctream::incremental(ints, [&calls] (const ctream::Ctream<int>& s) {
+        return s.filter([] (int i) { return i % 2 == 0; })
+                .map<long>([&calls] (int i) { ++calls; return long(i); });
+    }, ctream::collectors::Sum<long>{});
+    auto counts = ctream::incremental(ints, [] (const ctream::Ctream<int>& s) {
+        return s.map<int>([] (int i) { return i % 10; });
+    }, ctream::collectors::CountBy<int>{});
+
+    CHECK( sum.refresh() == 24995000L );
+    CHECK( sum.refresh() == 24995000L );
+    CHECK( calls == 5000 );
+    CHECK( counts.refresh().at(3) == 1000 );
+
+    // Refreshes without new elements return the previous result
+    const auto* previous = &counts.refresh();
+    CHECK( &counts.refresh() == previous );
+
+    // The hash tables of joins are built by the first refresh only
+    std::vector<int> evens;
+    for (int i = 0; i < 20000; i += 2)
+        evens.emplace_back(i);
+    std::atomic<long> keyCalls{0};
+    auto joined = ctream::incremental(ints, [&evens, &keyCalls] (const ctream::Ctream<int>& s) {
+        return s.lookupJoin<int, long>(ctream::toCtream(evens),
+                [] (const int& i) { return i; },
+                [&keyCalls] (const int& e) { ++keyCalls; return e; },
+                [] (const int& i, const int&) { return long(i); });
+    }, ctream::collectors::Sum<long>{});
+    CHECK( joined.refresh() == 24995000L );
+
+    for (int i = 10000; i < 10100; ++i)
+        ints.emplace_back(i);
+    CHECK( sum.refresh() == 25497450L );
+    CHECK( calls == 5050 );
+    CHECK( sum.processed() == 10100 );
+    CHECK( counts.refresh().at(3) == 1010 );
+    CHECK( joined.refresh() == 25497450L );
+    CHECK( keyCalls == 10000 );
+
+    // A vector that shrank is collected again
+    ints.resize(10);
+    CHECK( sum.refresh() == 20L );
+    CHECK( counts.refresh().size() == 10 );
+}
+
+TEST_CASE("Base.MoveFromRvalue") {
+    // Counts the copies of its instances
+    struct Tracked {
+        static std::atomic<int>& copies() { static std::atomic<int> c{0}; return c; }
+        std::string value;
+        Tracked(std::string v) : value{std::move(v)} {}
+        Tracked(const Tracked& o) : value{o.value} { ++copies(); }
+        Tracked(Tracked&& o) noexcept : value{std::move(o.value)} {}
+        Tracked& operator=(const Tracked& o) { value = o.value; ++copies(); return *this; }
+        Tracked& operator=(Tracked&& o) noexcept { value = std::move(o.value); return *this; }
+    };
+
+    std::vector<Tracked> values;
+    for (int i = 0; i < 5000; ++i)
+        values.emplace_back(std::to_string(i));
+
+    Tracked::copies() = 0;
+    auto moved = ctream::toCtream(std::move(values))
+            .filter([] (const Tracked& t) { return t.value.size() < 4; })
+            .toVector();
+    CHECK( Tracked::copies() == 0 );
+    REQUIRE( moved.size() == 1000 );
+    CHECK( moved.back().value == "999" );
+
+    // Elements created by a map are moved into the result
+    auto list = std::list<int>{1, 2, 3};
+    auto strings = ctream::toCtream(list)
+            .map<Tracked>([] (int i) { return Tracked{std::to_string(i)}; })
+            .toList();
+    CHECK( Tracked::copies() == 0 );
+    CHECK( strings.back().value == "3" );
+
+    // Borrowed elements are copied
+    std::vector<Tracked> borrowed{Tracked{"a"}, Tracked{"b"}};
+    Tracked::copies() = 0;
+    auto copied = ctream::toCtream(borrowed).toVector();
+    CHECK( Tracked::copies() == 2 );
+    CHECK( borrowed.front().value == "a" );
+
+    CHECK( ctream::toCtream(std::list<std::string>{"x", "y"}).map<std::string>().concat() == "xy" );
+
+    // Streams that moved the elements of their source cannot be collected again
+    auto owned = ctream::toCtream(std::vector<std::string>{"a", "b", "c"});
+    auto copy = owned.parallelism(2);
+    CHECK( owned.concat() == "abc" );
+    CHECK_THROWS_AS( owned.concat(), std::logic_error );
+    CHECK_THROWS_AS( copy.toVector(), std::logic_error );
+    CHECK_THROWS_AS( owned.cache().toVector(), std::logic_error );
+
+    // Unless their collects do not move them
+    auto lengths = ctream::toCtream(std::vector<std::string>{"a", "bb"})
+            .map<size_t>([] (const std::string& s) { return s.size(); });
+    CHECK( lengths.sum() == 3 );
+    CHECK( lengths.sum() == 3 );
+    auto cast = ctream::toCtream(std::vector<std::string>{"a", "bb"}).map<std::string>()
+            .map<size_t>([] (const std::string& s) { return s.size(); });
+    CHECK( cast.sum() == 3 );
+    CHECK_THROWS_AS( cast.sum(), std::logic_error );
+
+    // Nor can the other streams of their source
+    auto base = ctream::toCtream(std::vector<std::string>{"aaa", "bb", "c"});
+    auto sizes = base.map<size_t>([] (const std::string& s) { return s.size(); });
+    CHECK( sizes.sum() == 6 );
+    CHECK( base.concat() == "aaabbc" );
+    CHECK_THROWS_AS( sizes.sum(), std::logic_error );
+}
+
+TEST_CASE("Numa.SimulatedTopology") {
+    const long n = 100000;
+    std::vector<long> ints;
+    for (long i = 0; i < n; ++i)
+        ints.emplace_back(i);
+
+    // The first half of the vector is on node 1, the second half on node 0
+    auto topology = ctream::numa::Topology::simulated(2, 4);
+    const long* data = ints.data();
+    topology.locator = [data, n] (const void* address) {
+        return (static_cast<const long*>(address) < data + n / 2) ? 1 : 0;
+    };
+
+    auto stream = ctream::toCtream(ints).parallelism(4).numaAware(topology);
+    CHECK( stream.sum() == n * (n - 1) / 2 );
+    CHECK( stream.toVector() == ints );
+
+    // Each half is processed by the node that holds it
+    auto nodes = stream
+            .map<int>([] (long) { return ctream::numa::currentNode(); })
+            .toVector();
+    REQUIRE( nodes.size() == size_t(n) );
+    CHECK( nodes.front() == 1 );
+    CHECK( nodes[n / 2 - 1] == 1 );
+    CHECK( nodes[n / 2] == 0 );
+    CHECK( nodes.back() == 0 );
+    CHECK( ctream::numa::currentNode() == -1 );
+
+    // Without nodes, the stream is collected as usual
+    auto noNodes = ctream::toCtream(ints).parallelism(4).numaAware(ctream::numa::Topology{});
+    CHECK( noNodes.sum() == n * (n - 1) / 2 );
+}
+
+TEST_CASE("Numa.ParseCpuList") {
+    CHECK( ctream::numa::Topology::parseCpuList("0-3,8,10-11\n")
+            == std::vector<int>{0, 1, 2, 3, 8, 10, 11} );
+    CHECK( !ctream::numa::Topology::detect().nodes.empty() );
+}